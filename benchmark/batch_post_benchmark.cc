@@ -0,0 +1,105 @@
+/*
+    batch_post_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Tasks per second posted with task_queue::post_tasks and items per second
+// with event_queue::emplace_back_bulk, for batch sizes 1 to 1024.
+// Usage: batch_post_benchmark [total_count] [worker_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "task_queue.h"
+
+double post_tasks_rate(libtq::tq_st tq, int total_count, int batch_size) {
+  std::atomic<int> done(0);
+  auto begin = std::chrono::steady_clock::now();
+  for (int posted = 0; posted < total_count; posted += batch_size) {
+    libtq::task_batch_t batch;
+    batch.reserve((size_t)batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+      batch.push_back({TQ_TASK_LOC, [&done]() { ++done; }});
+    }
+    tq->post_tasks(std::move(batch));
+  }
+  int expected = (total_count + batch_size - 1) / batch_size * batch_size;
+  while (done != expected) {
+    std::this_thread::yield();
+  }
+  auto used = std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - begin).count();
+  return expected / used;
+}
+
+double emplace_bulk_rate(int total_count, int batch_size, unsigned int consumer_count) {
+  libtq::event_queue<int> eq;
+  std::vector<std::thread> consumers;
+  for (unsigned int c = 0; c < consumer_count; ++c) {
+    consumers.emplace_back([&eq]() {
+      while (auto r = eq.wait()) {
+        if (r->i < 0) break;
+      }
+    });
+  }
+  std::vector<int> items((size_t)batch_size);
+  auto begin = std::chrono::steady_clock::now();
+  for (int posted = 0; posted < total_count; posted += batch_size) {
+    for (int i = 0; i < batch_size; ++i) {
+      items[(size_t)i] = i;
+    }
+    eq.emplace_back_bulk(items.begin(), items.end());
+  }
+  for (unsigned int c = 0; c < consumer_count; ++c) {
+    eq.emplace_back(-1);
+  }
+  for (auto& t : consumers) t.join();
+  auto used = std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - begin).count();
+  return (total_count + batch_size - 1) / batch_size * batch_size / used;
+}
+
+int main(int argc, char* argv[]) {
+  int total_count = (argc > 1 ? atoi(argv[1]) : 1000000);
+  unsigned int worker_count = (argc > 2 ? (unsigned int)atoi(argv[2]) : 4);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, worker_count));
+  auto tq = libtq::task_queue::create(eq, wg);
+
+  printf("%8s %18s %22s\n", "batch", "post_tasks tasks/s", "emplace_back_bulk items/s");
+  for (int batch_size = 1; batch_size <= 1024; batch_size *= 2) {
+    double tq_rate = post_tasks_rate(tq, total_count, batch_size);
+    double eq_rate = emplace_bulk_rate(total_count, batch_size, worker_count);
+    printf("%8d %18.0f %22.0f\n", batch_size, tq_rate, eq_rate);
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+    event_queue_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Throughput of event_queue and lockfree_event_queue with the same count of
+// producers and consumers.
+// Usage: event_queue_benchmark [items_per_producer]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include "task_event_queue.h"
+#include "task_lockfree_event_queue.h"
+
+template <typename _Eq>
+bool push_item(_Eq& eq, int v);
+
+template <>
+bool push_item(libtq::event_queue<int>& eq, int v) {
+  eq.emplace_back(std::move(v));
+  return true;
+}
+
+template <>
+bool push_item(libtq::lockfree_event_queue<int>& eq, int v) {
+  return eq.emplace_back(std::move(v));
+}
+
+template <typename _Eq>
+double run(_Eq& eq, int thread_count, int items_per_producer) {
+  std::vector<std::thread> consumers;
+  std::vector<std::thread> producers;
+  auto begin = std::chrono::steady_clock::now();
+  for (int c = 0; c < thread_count; ++c) {
+    consumers.emplace_back([&eq]() {
+      while (auto r = eq.wait()) {
+        if (r->i < 0) break;
+      }
+    });
+  }
+  for (int p = 0; p < thread_count; ++p) {
+    producers.emplace_back([&eq, items_per_producer]() {
+      for (int i = 0; i < items_per_producer; ++i) {
+        while (!push_item(eq, i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& t : producers) t.join();
+  for (int c = 0; c < thread_count; ++c) {
+    while (!push_item(eq, -1)) {
+      std::this_thread::yield();
+    }
+  }
+  for (auto& t : consumers) t.join();
+  auto used = std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - begin).count();
+  return (double)thread_count * items_per_producer / used;
+}
+
+int main(int argc, char* argv[]) {
+  int items_per_producer = (argc > 1 ? atoi(argv[1]) : 100000);
+  printf("%8s %16s %16s\n", "threads", "mutex items/s", "lockfree items/s");
+  for (int n = 1; n <= 64; n *= 2) {
+    double mutex_rate = 0.0;
+    double lockfree_rate = 0.0;
+    {
+      libtq::event_queue<int> eq;
+      mutex_rate = run(eq, n, items_per_producer);
+    }
+    {
+      libtq::lockfree_event_queue<int> eq(4096);
+      lockfree_rate = run(eq, n, items_per_producer);
+    }
+    printf("%8d %16.0f %16.0f\n", n, mutex_rate, lockfree_rate);
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    serial_queue_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Throughput of busy serial queues with and without the run budget, and the
+// worst pickup latency of a probe task competing with them.
+// Usage: serial_queue_benchmark [tasks_per_queue] [queue_count] [worker_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "task_queue.h"
+
+struct result {
+  double tasks_per_sec;
+  double probe_max_us;
+};
+
+result run(unsigned int budget, int tasks_per_queue, int queue_count, unsigned int worker_count) {
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, worker_count));
+  std::vector<libtq::tq_st> queues;
+  for (int q = 0; q < queue_count; ++q) {
+    queues.push_back(libtq::task_queue::create(eq, wg));
+    queues.back()->set_run_budget(budget, std::chrono::microseconds(200));
+  }
+  auto probe = libtq::task_queue::create(eq, wg);
+  std::atomic<int> done(0);
+  auto begin = std::chrono::steady_clock::now();
+  for (auto& q : queues) {
+    libtq::task_batch_t batch;
+    for (int i = 0; i < tasks_per_queue; ++i) {
+      batch.push_back({TQ_TASK_LOC, [&done]() { ++done; }});
+    }
+    q->post_tasks(std::move(batch));
+  }
+  double probe_max_us = 0.0;
+  while (done != tasks_per_queue * queue_count) {
+    auto post_time = std::chrono::steady_clock::now();
+    std::atomic<bool> probed(false);
+    double latency = 0.0;
+    probe->post_task(TQ_TASK_LOC, [&probed, &latency, post_time]() {
+      latency = std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(
+        std::chrono::steady_clock::now() - post_time).count();
+      probed = true;
+    });
+    while (!probed) {
+      std::this_thread::yield();
+    }
+    if (latency > probe_max_us) probe_max_us = latency;
+  }
+  auto used = std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - begin).count();
+  return result{ tasks_per_queue * queue_count / used, probe_max_us };
+}
+
+int main(int argc, char* argv[]) {
+  int tasks_per_queue = (argc > 1 ? atoi(argv[1]) : 200000);
+  int queue_count = (argc > 2 ? atoi(argv[2]) : 4);
+  unsigned int worker_count = (argc > 3 ? (unsigned int)atoi(argv[3]) : 2);
+  printf("%8s %14s %16s\n", "budget", "tasks/s", "probe max us");
+  for (unsigned int budget : {1u, 8u, 64u, 256u}) {
+    auto r = run(budget, tasks_per_queue, queue_count, worker_count);
+    printf("%8u %14.0f %16.1f\n", budget, r.tasks_per_sec, r.probe_max_us);
+  }
+  return 0;
+}
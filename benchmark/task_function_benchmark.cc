@@ -0,0 +1,123 @@
+/*
+    task_function_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Allocations and time of a callable through its life in a task queue:
+// construct, move twice, invoke, destroy. Compare std::function with
+// libtq::unique_task for different capture sizes, then measure post_task.
+// Usage: task_function_benchmark [loop_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <array>
+#include <new>
+#include "task_queue.h"
+
+static std::atomic<size_t> g_alloc_count(0);
+
+void* operator new(size_t size) {
+  g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+struct result {
+  double allocs_per_op;
+  double ns_per_op;
+};
+
+template < typename _Fn, size_t capture_size >
+result run(int loop_count) {
+  std::array<char, capture_size> capture;
+  capture.fill(1);
+  volatile size_t sink = 0;
+  size_t alloc_begin = g_alloc_count.load();
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < loop_count; ++i) {
+    _Fn f([capture, &sink]() { sink += (size_t)capture[0]; });
+    _Fn f1(std::move(f));
+    _Fn f2(std::move(f1));
+    f2();
+  }
+  auto used = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(
+    std::chrono::steady_clock::now() - begin).count();
+  size_t allocs = g_alloc_count.load() - alloc_begin;
+  return result{ (double)allocs / loop_count, used / loop_count };
+}
+
+template < size_t capture_size >
+void compare(int loop_count) {
+  auto r_std = run<std::function<void()>, capture_size>(loop_count);
+  auto r_unique = run<libtq::unique_task, capture_size>(loop_count);
+  printf("%8u %14.2f %12.1f %14.2f %12.1f\n", (unsigned int)capture_size,
+    r_std.allocs_per_op, r_std.ns_per_op, r_unique.allocs_per_op, r_unique.ns_per_op);
+}
+
+int main(int argc, char* argv[]) {
+  int loop_count = (argc > 1 ? atoi(argv[1]) : 1000000);
+  printf("unique_task inline size: %u bytes\n", (unsigned int)LIBTQ_TASK_INLINE_SIZE);
+  printf("%8s %14s %12s %14s %12s\n", "capture", "std allocs/op", "std ns/op", "uniq allocs/op", "uniq ns/op");
+  compare<8>(loop_count);
+  compare<24>(loop_count);
+  compare<32>(loop_count);
+  compare<40>(loop_count);
+  compare<64>(loop_count);
+
+  // Posting through a task queue with a 32 bytes capture
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  auto tq = libtq::task_queue::create(eq, wg);
+  std::atomic<int> done(0);
+  std::array<char, 24> capture;
+  capture.fill(1);
+  size_t alloc_begin = g_alloc_count.load();
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < loop_count; ++i) {
+    tq->post_task(TQ_TASK_LOC, [capture, &done]() {
+      done += capture[0];
+    });
+  }
+  while (done != loop_count) {
+    std::this_thread::yield();
+  }
+  auto used = std::chrono::duration_cast<std::chrono::duration<double>>(
+    std::chrono::steady_clock::now() - begin).count();
+  printf("post_task: %.0f tasks/s, %.2f allocs/post\n", 
+    loop_count / used, (double)(g_alloc_count.load() - alloc_begin) / loop_count);
+  return 0;
+}
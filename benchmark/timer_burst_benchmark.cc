@@ -0,0 +1,86 @@
+/*
+    timer_burst_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Time to run a burst of once_after jobs due at the same deadline, spread
+// over some task queues, from the deadline to the last job done.
+// Usage: timer_burst_benchmark [jobs_per_burst] [round_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "task_timer.h"
+
+double run_burst(std::vector<libtq::tq_st>& queues, size_t queue_count, size_t job_count) {
+  std::atomic<size_t> done(0);
+  std::atomic<int64_t> last_ns(0);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+  for (size_t i = 0; i < job_count; ++i) {
+    libtq::timer::once_after(queues[i % queue_count], TQ_TASK_LOC, [&]() {
+      if (++done == job_count) {
+        last_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+      }
+    }, deadline - std::chrono::steady_clock::now());
+  }
+  while (done.load() < job_count) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+  return (double)(last_ns.load() - deadline_ns) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+  size_t job_count = (argc > 1 ? (size_t)atol(argv[1]) : 10000);
+  int round_count = (argc > 2 ? atoi(argv[2]) : 10);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  std::vector<libtq::tq_st> queues;
+  for (size_t i = 0; i < 64; ++i) {
+    queues.push_back(libtq::task_queue::create(eq, wg));
+  }
+
+  printf("%zu jobs per burst, best of %d rounds\n", job_count, round_count);
+  printf("%8s %12s %12s\n", "queues", "drain ms", "ns per job");
+  for (size_t queue_count = 1; queue_count <= queues.size(); queue_count *= 4) {
+    double best = 1e9;
+    for (int r = 0; r < round_count; ++r) {
+      double ms = run_burst(queues, queue_count, job_count);
+      if (ms < best) best = ms;
+    }
+    printf("%8zu %12.3f %12.1f\n", queue_count, best, best * 1e6 / (double)job_count);
+  }
+  return 0;
+}
+
+// Push Chen
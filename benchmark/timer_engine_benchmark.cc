@@ -0,0 +1,92 @@
+/*
+    timer_engine_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Cost of arming and cancelling timers with the heap and the timing wheel
+// engine. Every timer is far in the future, so none of them fires, then all
+// of them are cancelled in a shuffled order.
+// Usage: timer_engine_benchmark [timer_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "task_timer.h"
+
+struct engine_result {
+  double arm_ns;
+  double cancel_ns;
+};
+
+engine_result arm_and_cancel(libtq::tq_st tq, size_t count) {
+  std::vector<libtq::timer_handle> ids;
+  ids.reserve(count);
+  std::mt19937 rng(42);
+  // spread the timers from 10s to 70s, so they land in different wheel levels
+  std::uniform_int_distribution<unsigned int> delay(10000, 70000);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    ids.push_back(libtq::timer::once_after(tq, TQ_TASK_LOC, []() {}, delay(rng)));
+  }
+  auto armed = std::chrono::steady_clock::now();
+  std::shuffle(ids.begin(), ids.end(), rng);
+  auto shuffled = std::chrono::steady_clock::now();
+  for (auto id : ids) {
+    libtq::timer::cancel_once(id);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  engine_result r;
+  r.arm_ns = std::chrono::duration<double, std::nano>(armed - begin).count() / (double)count;
+  r.cancel_ns = std::chrono::duration<double, std::nano>(end - shuffled).count() / (double)count;
+  return r;
+}
+
+int main(int argc, char* argv[]) {
+  size_t count = (argc > 1 ? (size_t)atol(argv[1]) : 1000000);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  auto tq = libtq::task_queue::create(eq, wg);
+
+  printf("%8s %12s %14s %14s\n", "engine", "timers", "arm ns/timer", "cancel ns/timer");
+  libtq::timer::set_engine(libtq::timer_engine_type::k_heap);
+  auto h = arm_and_cancel(tq, count);
+  printf("%8s %12zu %14.1f %14.1f\n", "heap", count, h.arm_ns, h.cancel_ns);
+
+  libtq::timer::set_engine(libtq::timer_engine_type::k_wheel, std::chrono::milliseconds(1));
+  auto w = arm_and_cancel(tq, count);
+  printf("%8s %12zu %14.1f %14.1f\n", "wheel", count, w.arm_ns, w.cancel_ns);
+  return 0;
+}
+
+// Push Chen
@@ -0,0 +1,113 @@
+/*
+    timer_jitter_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Histogram of how late a 1 ms once_after job fires with each timer backend,
+// measured when the job starts on the worker. Busy threads can be added to
+// put the machine under load.
+// Usage: timer_jitter_benchmark [fire_count] [busy_thread_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "task_timer.h"
+
+static const long k_buckets[] = { 10, 20, 50, 100, 200, 500, 1000 };
+enum { k_bucket_count = sizeof(k_buckets) / sizeof(k_buckets[0]) + 1 };
+
+void run_backend(const char* name, libtq::tq_st tq, int fire_count) {
+  std::vector<long> lateness;
+  lateness.reserve((size_t)fire_count);
+  for (int i = 0; i < fire_count; ++i) {
+    std::atomic<bool> done(false);
+    auto expected = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    libtq::timer::once_after(tq, TQ_TASK_LOC, [&]() {
+      lateness.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - expected).count());
+      done = true;
+    }, 1);
+    while (!done) {
+      std::this_thread::yield();
+    }
+  }
+
+  size_t hist[k_bucket_count] = {0};
+  long worst = 0;
+  for (long l : lateness) {
+    size_t b = 0;
+    while (b < k_bucket_count - 1 && l >= k_buckets[b]) ++b;
+    ++hist[b];
+    if (l > worst) worst = l;
+  }
+  printf("%-10s", name);
+  for (size_t b = 0; b < k_bucket_count; ++b) {
+    printf(" %7.2f%%", 100.0 * (double)hist[b] / (double)lateness.size());
+  }
+  printf(" %8ld\n", worst);
+}
+
+int main(int argc, char* argv[]) {
+  int fire_count = (argc > 1 ? atoi(argv[1]) : 2000);
+  int busy_count = (argc > 2 ? atoi(argv[2]) : 0);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  auto tq = libtq::task_queue::create(eq, wg);
+
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> busy;
+  for (int i = 0; i < busy_count; ++i) {
+    busy.emplace_back([&stop]() {
+      volatile unsigned long x = 0;
+      while (!stop) ++x;
+    });
+  }
+
+  printf("lateness of %d fires in microseconds, %d busy threads\n", fire_count, busy_count);
+  printf("%-10s", "backend");
+  for (size_t b = 0; b < k_bucket_count - 1; ++b) {
+    printf("   <%5ld", k_buckets[b]);
+  }
+  printf("  >=%5ld %8s\n", k_buckets[k_bucket_count - 2], "max");
+  if (libtq::timer::set_backend(libtq::timer_backend::k_condition_variable)) {
+    run_backend("condvar", tq, fire_count);
+  }
+  if (libtq::timer::set_backend(libtq::timer_backend::k_timerfd)) {
+    run_backend("timerfd", tq, fire_count);
+  }
+
+  stop = true;
+  for (auto& b : busy) b.join();
+  return 0;
+}
+
+// Push Chen
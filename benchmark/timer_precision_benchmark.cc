@@ -0,0 +1,90 @@
+/*
+    timer_precision_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Lateness percentiles of sub millisecond once_after jobs, with and without
+// the spin before the deadline, measured when the job starts on the worker.
+// Usage: timer_precision_benchmark [sample_count] [spin_threshold_us]
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "task_timer.h"
+
+void run_delay(libtq::tq_st tq, std::chrono::microseconds delay, int sample_count, const char* mode) {
+  std::vector<double> lateness;
+  lateness.reserve((size_t)sample_count);
+  for (int i = 0; i < sample_count; ++i) {
+    std::atomic<bool> done(false);
+    auto expected = std::chrono::steady_clock::now() + delay;
+    libtq::timer::once_after(tq, TQ_TASK_LOC, [&]() {
+      lateness.push_back(std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - expected).count());
+      done = true;
+    }, delay);
+    while (!done) {
+      std::this_thread::sleep_for(std::chrono::microseconds(delay.count() / 4 + 1));
+    }
+  }
+  std::sort(lateness.begin(), lateness.end());
+  auto pct = [&lateness](double p) {
+    size_t idx = (size_t)(p * (double)(lateness.size() - 1));
+    return lateness[idx];
+  };
+  printf("%-8s %8lld %10.1f %10.1f %10.1f %10.1f\n", mode, (long long)delay.count(),
+    pct(0.5), pct(0.99), pct(0.999), lateness.back());
+}
+
+int main(int argc, char* argv[]) {
+  int sample_count = (argc > 1 ? atoi(argv[1]) : 2000);
+  long spin_us = (argc > 2 ? atol(argv[2]) : 50);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  auto tq = libtq::task_queue::create(eq, wg);
+
+  const long delays[] = { 100, 250, 500, 1000 };
+  printf("lateness in microseconds, %d samples\n", sample_count);
+  printf("%-8s %8s %10s %10s %10s %10s\n", "mode", "delay us", "p50", "p99", "p999", "max");
+  libtq::timer::set_spin_threshold(libtq::duration_t::zero());
+  for (long d : delays) {
+    run_delay(tq, std::chrono::microseconds(d), sample_count, "sleep");
+  }
+  libtq::timer::set_spin_threshold(std::chrono::microseconds(spin_us));
+  for (long d : delays) {
+    run_delay(tq, std::chrono::microseconds(d), sample_count, "spin");
+  }
+  return 0;
+}
+
+// Push Chen
@@ -0,0 +1,82 @@
+/*
+    timer_shard_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Arm and cancel throughput of timers with 1 to 8 timer shards. Every thread
+// arms timers for its own task queue, far in the future, and cancels them.
+// Usage: timer_shard_benchmark [timers_per_thread] [thread_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "task_timer.h"
+
+double arm_cancel_rate(std::vector<libtq::tq_st>& queues, size_t per_thread) {
+  std::vector<std::thread> threads;
+  auto begin = std::chrono::steady_clock::now();
+  for (auto& q : queues) {
+    threads.emplace_back([&q, per_thread]() {
+      std::vector<libtq::timer_handle> handles;
+      handles.reserve(per_thread);
+      for (size_t i = 0; i < per_thread; ++i) {
+        handles.push_back(libtq::timer::once_after(q, TQ_TASK_LOC, []() {}, 10000));
+      }
+      for (auto& h : handles) {
+        libtq::timer::cancel_once(h);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  auto used = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  return (double)(per_thread * queues.size() * 2) / used;
+}
+
+int main(int argc, char* argv[]) {
+  size_t per_thread = (argc > 1 ? (size_t)atol(argv[1]) : 100000);
+  size_t thread_count = (argc > 2 ? (size_t)atol(argv[2]) : 4);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  std::vector<libtq::tq_st> queues;
+  for (size_t i = 0; i < thread_count; ++i) {
+    queues.push_back(libtq::task_queue::create(eq, wg));
+  }
+
+  printf("%zu threads, %zu timers each, %u cpus\n", thread_count, per_thread, std::thread::hardware_concurrency());
+  printf("%8s %16s\n", "shards", "arm+cancel ops/s");
+  for (size_t shards = 1; shards <= 8; shards *= 2) {
+    libtq::timer::set_shards(shards);
+    printf("%8zu %16.0f\n", shards, arm_cancel_rate(queues, per_thread));
+  }
+  return 0;
+}
+
+// Push Chen
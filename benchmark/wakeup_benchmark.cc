@@ -0,0 +1,102 @@
+/*
+    wakeup_benchmark.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Measure how many context switches one post costs on an idle worker group,
+// and how much CPU an idle worker group burns.
+// Usage: wakeup_benchmark [worker_count] [post_count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <sys/resource.h>
+#include "task_queue.h"
+
+struct usage_sample {
+  double cpu_ms;
+  long   csw;
+};
+
+static usage_sample sample_usage() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  usage_sample s;
+  s.cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+  s.csw = ru.ru_nvcsw + ru.ru_nivcsw;
+  return s;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int worker_count = (argc > 1 ? (unsigned int)atoi(argv[1]) : 8);
+  int post_count = (argc > 2 ? atoi(argv[2]) : 1000);
+  const auto gap = std::chrono::microseconds(500);
+
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, worker_count));
+  auto tq = libtq::task_queue::create(eq, wg);
+  while (eq->waiter_count() != worker_count) {
+    std::this_thread::yield();
+  }
+
+  // Idle pool
+  auto idle_begin = sample_usage();
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  auto idle_end = sample_usage();
+  printf("idle pool: %u workers, cpu %.2f ms/s, %.1f context switches/s\n",
+    worker_count, (idle_end.cpu_ms - idle_begin.cpu_ms) / 2.0,
+    (double)(idle_end.csw - idle_begin.csw) / 2.0);
+
+  // The sleep of the posting thread itself, used as the baseline
+  auto sleep_begin = sample_usage();
+  for (int i = 0; i < post_count; ++i) {
+    std::this_thread::sleep_for(gap);
+  }
+  auto sleep_end = sample_usage();
+
+  // Post one task at a time to an idle pool
+  std::atomic<int> done(0);
+  auto post_begin = sample_usage();
+  for (int i = 0; i < post_count; ++i) {
+    tq->post_task(TQ_TASK_LOC, [&done]() {
+      ++done;
+    });
+    std::this_thread::sleep_for(gap);
+  }
+  auto post_end = sample_usage();
+  while (done != post_count) {
+    std::this_thread::yield();
+  }
+  double csw_per_post = (double)((post_end.csw - post_begin.csw) - (sleep_end.csw - sleep_begin.csw)) / post_count;
+  double cpu_per_post = ((post_end.cpu_ms - post_begin.cpu_ms) - (sleep_end.cpu_ms - sleep_begin.cpu_ms)) * 1000.0 / post_count;
+  printf("post to idle pool: %d posts, %.2f context switches/post, %.2f us cpu/post\n",
+    post_count, csw_per_post, cpu_per_post);
+  return 0;
+}
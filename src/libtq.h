@@ -34,6 +34,7 @@ SOFTWARE.
 #ifndef LIBTQ_H__
 #define LIBTQ_H__
 
+#include "task_clock.h"
 #include "task_queue.h"
 #include "task_threadsafe.h"
 #include "task_timer.h"
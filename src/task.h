@@ -36,6 +36,9 @@ SOFTWARE.
 
 #include <functional>
 #include <chrono>
+#include <cstdint>
+#include <memory>
+#include "task_function.h"
 
 #if defined(_WIN32)
 #pragma warning(disable: 4820)
@@ -45,9 +48,10 @@ SOFTWARE.
 namespace libtq {
 
 struct task;
+struct task_queue_impl;
 
-typedef std::function<void()>                     task_t;
-typedef std::function<void(task*)>                task_hook_t;
+typedef unique_task                               task_t;
+typedef unique_function<void(task*)>              task_hook_t;
 typedef std::chrono::steady_clock                 task_clock_t;
 typedef std::chrono::time_point<task_clock_t>     task_time_t;
 typedef std::chrono::nanoseconds                  duration_t;
@@ -65,6 +69,41 @@ struct alignas(intptr_t) task_location {
 
 #define TQ_TASK_LOC       __TQ_TASK_LOC
 
+/**
+ * @brief Highest trace level compiled in, 0 to 3 as trace_level, set by the
+ * TQ_TRACE_LEVEL option. The code of the higher levels is left out.
+*/
+#ifndef LIBTQ_TRACE_LEVEL
+#define LIBTQ_TRACE_LEVEL         3
+#endif
+
+/**
+ * @brief What a task queue records for its tasks, each level includes the lower ones
+*/
+enum class trace_level : int {
+  // nothing, no clock read and no trace item
+  k_off           = 0,
+  // the location of the recent tasks
+  k_location      = 1,
+  // the post, begin and end time of the recent tasks, the default
+  k_timestamps    = 2,
+  // histograms of the wait and run time of all tasks
+  k_histogram     = 3
+};
+
+/**
+ * @brief Log2 histograms of a task queue, bucket i counts the durations in
+ * [2^i, 2^(i+1)) nanoseconds, the first one also counts zero and the last
+ * one everything longer
+*/
+struct task_trace_histogram {
+  enum { k_buckets = 40 };
+  // from post to begin
+  uint64_t      wait[k_buckets];
+  // from begin to end
+  uint64_t      run[k_buckets];
+};
+
 struct alignas(intptr_t) task_trace_item {
   task_location   loc;
   task_time_t     post_time;
@@ -76,6 +115,8 @@ struct alignas(intptr_t) task : public task_trace_item {
   task_t        t;
   task_hook_t   before;
   task_hook_t   after;
+  // the serial queue the task belongs to, the worker advances it after the task is done
+  std::shared_ptr<task_queue_impl>  owner;
 };
 
 #define LIBTQ_DISABLE_COPY(clz)   \
@@ -0,0 +1,84 @@
+/*
+    task_clock.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "task_clock.h"
+#include "task_timer.h"
+
+namespace libtq {
+
+static std::atomic<task_clock*> g_task_clock(nullptr);
+
+void set_task_clock(task_clock* clock) {
+  g_task_clock.store(clock, std::memory_order_release);
+}
+
+task_clock* get_task_clock() {
+  return g_task_clock.load(std::memory_order_acquire);
+}
+
+task_time_t task_now() {
+  task_clock* clock = g_task_clock.load(std::memory_order_acquire);
+  if (clock == nullptr) {
+    return std::chrono::steady_clock::now();
+  }
+  return clock->now();
+}
+
+manual_clock::manual_clock() : manual_clock(std::chrono::steady_clock::now()) {}
+
+manual_clock::manual_clock(task_time_t start) :
+  now_ns_((int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count())
+{
+}
+
+task_time_t manual_clock::now() {
+  return task_time_t(duration_t(now_ns_.load(std::memory_order_acquire)));
+}
+
+void manual_clock::advance(duration_t d) {
+  if (d > duration_t::zero()) {
+    now_ns_.fetch_add((int64_t)d.count(), std::memory_order_acq_rel);
+  }
+  timer::sync_to_clock();
+}
+
+void manual_clock::advance_to(task_time_t t) {
+  int64_t ns = (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+  int64_t cur = now_ns_.load(std::memory_order_acquire);
+  // never goes back
+  while (cur < ns && !now_ns_.compare_exchange_weak(cur, ns, std::memory_order_acq_rel)) {
+  }
+  timer::sync_to_clock();
+}
+
+} // namespace libtq
+
+// Push Chen
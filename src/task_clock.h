@@ -0,0 +1,107 @@
+/*
+    task_clock.h
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#ifndef LIBTQ_TASK_CLOCK_H__
+#define LIBTQ_TASK_CLOCK_H__
+
+#include <atomic>
+#include "task.h"
+
+namespace libtq {
+
+/**
+ * @brief Source of the time for the timers, the task queue timestamps and
+ * the worker loop. The default is std::chrono::steady_clock, see set_task_clock.
+*/
+class task_clock {
+public:
+  virtual ~task_clock() {}
+
+  /**
+   * @brief Current time, on the time line of steady_clock
+  */
+  virtual task_time_t now() = 0;
+
+  /**
+   * @brief True if the time only moves when told to, the timer threads then
+   * wait to be woken up instead of sleeping to the next deadline
+  */
+  virtual bool is_virtual() const { return false; }
+};
+
+/**
+ * @brief Virtual clock for tests, the time only moves by advance, so hours of
+ * timers can be run in milliseconds. Starts at the current steady_clock time.
+*/
+class manual_clock : public task_clock {
+public:
+  manual_clock();
+  explicit manual_clock(task_time_t start);
+
+  task_time_t now() override;
+  bool is_virtual() const override { return true; }
+
+  /**
+   * @brief Move the time forward, and wait for the timer threads to fire every
+   * job due by the new time. The tasks posted by the jobs may not be done yet.
+  */
+  void advance(duration_t d);
+  void advance_to(task_time_t t);
+
+protected:
+  std::atomic<int64_t> now_ns_;
+};
+
+/**
+ * @brief Replace the clock of the library, nullptr to go back to steady_clock.
+ * Pending timers keep their fire time, the new clock should go on from the
+ * time of the old one. The clock is used by other threads with no reference
+ * held, it should live till the end of the process.
+*/
+void set_task_clock(task_clock* clock);
+
+/**
+ * @brief The clock set by set_task_clock, nullptr for steady_clock
+*/
+task_clock* get_task_clock();
+
+/**
+ * @brief Current time of the library clock
+*/
+task_time_t task_now();
+
+} // namespace libtq
+
+#endif
+
+// Push Chen
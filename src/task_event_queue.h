@@ -39,11 +39,17 @@ SOFTWARE.
 #include <mutex>
 #include <condition_variable>
 #include <memory>
-#include <list>
+#include <vector>
+#include <iterator>
+#include <type_traits>
 #include <array>
 #include <atomic>
-#include <unordered_map>
 #include <thread>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #if defined(_WIN32)
 #pragma warning(disable: 4820)
@@ -51,6 +57,31 @@ SOFTWARE.
 #endif
 
 namespace libtq {
+/**
+ * @brief Index of the lowest set bit, bits should not be zero
+*/
+inline size_t lowest_bit(uint64_t bits) {
+#if defined(_MSC_VER)
+  unsigned long idx = 0;
+  _BitScanForward64(&idx, bits);
+  return (size_t)idx;
+#else
+  return (size_t)__builtin_ctzll(bits);
+#endif
+}
+
+/**
+ * @brief Index of the highest set bit, bits should not be zero
+*/
+inline size_t highest_bit(uint64_t bits) {
+#if defined(_MSC_VER)
+  unsigned long idx = 0;
+  _BitScanReverse64(&idx, bits);
+  return (size_t)idx;
+#else
+  return (size_t)(63 - __builtin_clzll(bits));
+#endif
+}
 
 /**
  * @brief Event Queue
@@ -62,8 +93,10 @@ public:
   /**
    * @brief C'str, 
   */
-  event_queue() : st_(true), is_(0) {
-
+  event_queue() : st_(true), is_(0), lanes_(0), local_pending_(0), waiting_(0), waiting_mask_(0), idle_mask_(0), registered_(nullptr) {
+    static_assert(max_priority > 0 && max_priority <= 64, "max_priority should be in [1, 64]");
+    waiting_count_.fill(0);
+    idle_.fill(nullptr);
   }
   event_queue(const event_queue&) = delete;
   event_queue(event_queue&&) = delete;
@@ -75,7 +108,7 @@ public:
   */
   ~event_queue() {
     this->break_queue();
-    while (pending_threads_.size() > 0) {
+    while (this->waiter_count() > 0) {
       std::this_thread::yield();
     }
   }
@@ -86,52 +119,211 @@ public:
     size_t prio;
     _Ty i;
   };
-  typedef std::weak_ptr<item_wrapper>     item_weak_t;
-  typedef std::shared_ptr<item_wrapper>   item_strong_t;
-  typedef std::lock_guard<std::mutex>     eq_lg_t;
-  typedef std::unique_lock<std::mutex>    eq_ul_t;
+
+  /**
+   * @brief Pooled storage of an item, also linked in the lane it is queued in.
+   * A node is never freed before the queue, gen changes every time the node
+   * goes back to the pool, so a stale handle can be detected.
+  */
+  struct item_node {
+    typename std::aligned_storage<sizeof(item_wrapper), alignof(item_wrapper)>::type storage;
+    item_node*  prev;
+    item_node*  next;
+    uint64_t    gen;
+    bool        queued;
+
+    item_wrapper* item() {
+      return reinterpret_cast<item_wrapper*>(&storage);
+    }
+    static item_node* of(item_wrapper* w) {
+      return reinterpret_cast<item_node*>(w);
+    }
+  };
+
+  /**
+   * @brief Recycled item nodes of the queue. Acquiring takes a small lock of
+   * its own, releasing is lock free: released nodes are pushed to a returned
+   * stack, which is taken back as a whole when the free list runs out.
+  */
+  class item_pool {
+  public:
+    enum { k_chunk_size = 64 };
+    item_pool() : free_(nullptr), returned_(nullptr), capacity_(0) {}
+    item_pool(const item_pool&) = delete;
+    item_pool& operator= (const item_pool&) = delete;
+
+    /**
+     * @brief Take count nodes with one lock, linked by next, not constructed
+    */
+    item_node* acquire_raw(size_t count) {
+      item_node* first = nullptr;
+      std::lock_guard<std::mutex> lg(this->l_);
+      for (size_t c = 0; c < count; ++c) {
+        if (free_ == nullptr) {
+          free_ = returned_.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (free_ == nullptr) {
+          this->grow_();
+        }
+        item_node* n = free_;
+        free_ = n->next;
+        n->next = first;
+        first = n;
+      }
+      return first;
+    }
+
+    item_wrapper* acquire(_Ty&& i, size_t prio) {
+      item_node* n = nullptr;
+      {
+        std::lock_guard<std::mutex> lg(this->l_);
+        if (free_ == nullptr) {
+          free_ = returned_.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (free_ == nullptr) {
+          this->grow_();
+        }
+        n = free_;
+        free_ = n->next;
+      }
+      n->prev = n->next = nullptr;
+      return new (&n->storage) item_wrapper(std::move(i), prio);
+    }
+
+    void release(item_wrapper* w) {
+      w->~item_wrapper();
+      item_node* n = item_node::of(w);
+      ++n->gen;
+      item_node* head = returned_.load(std::memory_order_relaxed);
+      do {
+        n->next = head;
+      } while (!returned_.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Node count ever allocated by the pool
+    */
+    size_t capacity() const {
+      std::lock_guard<std::mutex> lg(this->l_);
+      return capacity_;
+    }
+
+  protected:
+    void grow_() {
+      std::unique_ptr<item_node[]> chunk(new item_node[k_chunk_size]);
+      for (size_t i = 0; i < k_chunk_size; ++i) {
+        chunk[i].gen = 0;
+        chunk[i].queued = false;
+        chunk[i].prev = nullptr;
+        chunk[i].next = (i + 1 < k_chunk_size ? &chunk[i + 1] : free_);
+      }
+      free_ = &chunk[0];
+      chunks_.emplace_back(std::move(chunk));
+      capacity_ += k_chunk_size;
+    }
+
+    mutable std::mutex                          l_;
+    item_node*                                  free_;
+    std::atomic<item_node*>                     returned_;
+    size_t                                      capacity_;
+    std::vector<std::unique_ptr<item_node[]>>   chunks_;
+  };
+
+  /**
+   * @brief Give the node back to the pool when the picked up item is released
+  */
+  struct item_recycler {
+    item_pool* p = nullptr;
+    void operator() (item_wrapper* w) const {
+      p->release(w);
+    }
+  };
+
+  /**
+   * @brief Cancel handle of a queued item, plain value, costs nothing to keep or drop
+  */
+  struct item_handle {
+    item_node*  node = nullptr;
+    uint64_t    gen = 0;
+    explicit operator bool() const {
+      return node != nullptr;
+    }
+  };
+
+  typedef std::unique_ptr<item_wrapper, item_recycler>  item_strong_t;
+  typedef std::lock_guard<std::mutex>                   eq_lg_t;
+  typedef std::unique_lock<std::mutex>                  eq_ul_t;
+
+  /**
+   * @brief Parking slot of a waiting thread, each waiter sleeps on its own cv
+   * and is only woken when an item is handed to it or it has been broken.
+   * A long living thread registers its slot once and reuses it for every wait.
+  */
+  class waiter {
+  public:
+    waiter() = default;
+    waiter(const waiter&) = delete;
+    waiter& operator= (const waiter&) = delete;
+  private:
+    friend class event_queue;
+    size_t                    level = 1;
+    std::thread::id           tid;
+    bool                      registered = false;
+    bool                      waiting = false;
+    bool                      idle = false;
+    bool                      signaled = false;
+    bool                      broken = false;
+    bool                      nudged = false;
+    std::condition_variable   cv;
+    waiter*                   reg_prev = nullptr;
+    waiter*                   reg_next = nullptr;
+    waiter*                   idle_prev = nullptr;
+    waiter*                   idle_next = nullptr;
+  };
 
 public:
 
-  // void register_worker(size_t priority = normal_priority, int p_in) {
-    
-  // }
+  /**
+   * @brief Register a waiter slot to the queue, the slot must be unregistered
+   * before it is destroyed unless the queue has gone first
+  */
+  void register_waiter(waiter& w) {
+    eq_lg_t lg(this->l_);
+    this->register_(w);
+  }
+
+  /**
+   * @brief Unregister a waiter slot, do nothing if the slot is not registered
+  */
+  void unregister_waiter(waiter& w) {
+    eq_lg_t lg(this->l_);
+    this->unregister_(w);
+  }
 
   /**
    * @brief Block and wait for item, unless break the queue
+   * @remarks pred is checked when entering and every time the waiter is woken up,
+   * use break_waiter to wake up the thread after changing the state pred relies on.
    * @return shared ptr of the item, or nullptr
   */
   item_strong_t wait(size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
     eq_ul_t ul(this->l_);
-    auto tid = std::this_thread::get_id();
-    pending_threads_[tid] = priority;
-    while (!cv_.wait_for(ul, std::chrono::milliseconds(10), [this, tid, pred]() {
-      auto tp = this->pending_threads_[tid];
-      return (
-        (tp != 0 && this->is_ > 0) ||  // current thread is alive and has pending item, means get signal
-        (tp == 0) ||  // current thread is broken, need stop waiting
-        (this->st_ == false) || // current queue has been broken, need stop waiting
-        (pred && pred())
-      );
-    }));
-    // cv_.wait(ul, [this, tid, pred]() {
-    // });
-    auto tp = pending_threads_[tid];
-    pending_threads_.erase(tid);
-
-    // Queue or thread has been broken, return nothing
-    if (this->st_ == false || tp == 0) {
-      return nullptr;
-    }
-    if (pred && pred()) {
-      return nullptr;
-    }
-    // Will happen in a very low chance, when invoke
-    // emplace and cancel_all in a very short time.
-    if (is_ == 0) {
+    waiter w;
+    this->register_(w);
+    item_strong_t r = this->wait_(ul, w, priority, pred);
+    this->unregister_(w);
+    return r;
+  }
+
+  /**
+   * @brief Block and wait for item on a registered waiter slot
+  */
+  item_strong_t wait(waiter& w, size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    eq_ul_t ul(this->l_);
+    if (!w.registered) {
       return nullptr;
     }
-    return this->pick_up_(priority);
+    return this->wait_(ul, w, priority, pred);
   }
 
   /**
@@ -139,78 +331,121 @@ public:
    * @return shared ptr of the item or nullptr
   */
   item_strong_t wait_for(std::chrono::nanoseconds timeout, size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
     eq_ul_t ul(this->l_);
-    auto tid = std::this_thread::get_id();
-    pending_threads_[tid] = priority;
-    auto ret = cv_.wait_for(ul, timeout, [this, tid, pred]() {
-      // same as wait
-      auto pt = this->pending_threads_[tid];
-      return (
-        (pt != 0 && this->is_ > 0) ||
-        (pt == 0) ||
-        (this->st_ == false) || 
-        (pred && pred())
-      );
-    });
-    auto pt = pending_threads_[tid];
-    pending_threads_.erase(tid);
-
-    // Queue or thread has been broken, return nothing
-    if (this->st_ == false || pt == 0) {
-      return nullptr;
-    }
-    if (pred && pred()) {
-      return nullptr;
-    }
-    // Will happen in a very low chance, when invoke
-    // emplace and cancel_all in a very short time.
-    if (this->is_ == 0) {
-      return nullptr;
-    }
-    // timeout for current waiting oprand
-    if (!ret) {
+    waiter w;
+    this->register_(w);
+    item_strong_t r = this->wait_until_(ul, w, priority, pred, deadline);
+    this->unregister_(w);
+    return r;
+  }
+
+  /**
+   * @brief Block and wait for item on a registered waiter slot till timeout
+  */
+  item_strong_t wait_for(std::chrono::nanoseconds timeout, waiter& w, size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    eq_ul_t ul(this->l_);
+    if (!w.registered) {
       return nullptr;
     }
-    return this->pick_up_(priority);
+    return this->wait_until_(ul, w, priority, pred, deadline);
   }
 
 public:
   /**
    * @brief Add item to the end of the queue
+   * @return handle to cancel the item, empty if the item is not queued
   */
-  item_weak_t emplace_back(_Ty&& item, size_t priority = normal_priority) {
+  item_handle emplace_back(_Ty&& item, size_t priority = normal_priority) {
     // a broken item should not be added to the queue
-    if (priority <= 0) {
-      return item_weak_t();
+    if (priority <= 0 || st_ == false) {
+      return item_handle();
+    }
+    return this->push_(this->make_item(std::move(item), priority), false);
+  }
+
+  /**
+   * @brief Add an item made by make_item to the end of the queue
+  */
+  item_handle emplace_back(item_strong_t&& item) {
+    if (!item || item->prio <= 0) {
+      return item_handle();
+    }
+    return this->push_(std::move(item), false);
+  }
+
+  /**
+   * @brief Add all items in [begin, end) to the end of the queue in order,
+   * with one lock and one wake up decision. Items are moved out of the range.
+   * @return the count of queued items
+  */
+  template < typename _Iter >
+  size_t emplace_back_bulk(_Iter begin, _Iter end, size_t priority = normal_priority) {
+    if (priority <= 0 || st_ == false) {
+      return 0;
+    }
+    size_t count = (size_t)std::distance(begin, end);
+    if (count == 0) {
+      return 0;
+    }
+    // construct the items out of the lock, the nodes stay linked by next
+    item_node* nodes = pool_.acquire_raw(count);
+    item_node* n = nodes;
+    for (_Iter it = begin; it != end; ++it, n = n->next) {
+      new (&n->storage) item_wrapper(std::move(*it), priority);
     }
-    item_strong_t i(new item_wrapper(std::move(item), priority));
-    item_weak_t r = i;
     eq_lg_t lg(this->l_);
     if (st_ == false) {
-      return r;
+      while (nodes != nullptr) {
+        n = nodes;
+        nodes = n->next;
+        pool_.release(n->item());
+      }
+      return 0;
     }
-    il_[priority - 1].emplace_back(std::move(i));
-    ++is_;
-    cv_.notify_all();
-    return r;
+    while (nodes != nullptr) {
+      n = nodes;
+      nodes = n->next;
+      il_[priority - 1].push_back(n);
+    }
+    is_ += count;
+    this->update_lane_(priority);
+    // wake up as many waiters as the items, stop when nobody is idle
+    for (size_t i = 0; i < count && this->notify_waiter_(priority); ++i) {}
+    return count;
   }
 
   /**
    * @brief Insert item to the beginning of the queue
   */
-  item_weak_t emplace_front(_Ty&& item, size_t priority = normal_priority) {
+  item_handle emplace_front(_Ty&& item, size_t priority = normal_priority) {
     // a broken item should not be added to the queue
-    if (priority <= 0) return item_weak_t();
-    item_strong_t i(new item_wrapper(std::move(item), priority));
-    item_weak_t r = i;
-    eq_lg_t lg(this->l_);
-    if (st_ == false) {
-      return r;
+    if (priority <= 0 || st_ == false) {
+      return item_handle();
     }
-    il_[priority - 1].emplace_front(std::move(i));
-    ++is_;
-    cv_.notify_all();
-    return r;
+    return this->push_(this->make_item(std::move(item), priority), true);
+  }
+
+  /**
+   * @brief Make an item in the node pool without queueing it
+  */
+  item_strong_t make_item(_Ty&& item, size_t priority = normal_priority) {
+    return this->adopt_item(pool_.acquire(std::move(item), priority));
+  }
+
+  /**
+   * @brief Take back the ownership of an item released from item_strong_t
+  */
+  item_strong_t adopt_item(item_wrapper* w) {
+    return item_strong_t(w, item_recycler{&pool_});
+  }
+
+  /**
+   * @brief Node count allocated by the pool of the queue
+  */
+  size_t pool_capacity() const {
+    return pool_.capacity();
   }
 
   /**
@@ -218,30 +453,94 @@ public:
   */
   void cancel_all() {
     eq_lg_t lg(this->l_);
-    // clear all item
-    for (unsigned int i = 0; i < max_priority; ++i) {
-      il_[i].clear();
-    }
-    is_ = 0;
+    this->clear_();
   }
 
   /**
    * @brief Cancel a specified item if it is still in queue
   */
-  void cancel(item_weak_t i) {
-    if (item_strong_t si = i.lock()) {
-      eq_lg_t lg(this->l_);
-      // Mark the item as invalidate
-      for (unsigned int idx = 0; idx < max_priority; ++idx) {
-        auto it = il_[idx].begin();
-        for(; it != il_[idx].end(); ++it) {
-          if (*it != si) continue;
-          il_[idx].erase(it);
-          --is_;
-          break;
-        }
-      }
+  void cancel(item_handle h) {
+    if (!h) {
+      return;
+    }
+    eq_lg_t lg(this->l_);
+    // the node may have been picked up and reused by another item
+    if (!h.node->queued || h.node->gen != h.gen) {
+      return;
+    }
+    size_t prio = h.node->item()->prio;
+    il_[prio - 1].erase(h.node);
+    --is_;
+    this->update_lane_(prio);
+    pool_.release(h.node->item());
+  }
+
+  /**
+   * @brief Pick up an item without blocking
+   * @return shared ptr of the item, or nullptr
+  */
+  item_strong_t try_pick(size_t priority = normal_priority) {
+    eq_lg_t lg(this->l_);
+    if (this->st_ == false || is_ == 0) {
+      return nullptr;
+    }
+    return this->pick_up_(level_of_(priority));
+  }
+
+  /**
+   * @brief Check if there is any item whose priority is higher than the given one,
+   * lock free, only a hint
+  */
+  bool has_pending_above(size_t priority) const {
+    if (priority >= max_priority) {
+      return false;
+    }
+    return (lanes_.load(std::memory_order_relaxed) >> priority) != 0;
+  }
+
+  /**
+   * @brief Wake up one idle waiter without giving it an item, its wait returns nullptr.
+   * Used to tell an idle thread there is work somewhere else.
+  */
+  void wake_waiter() {
+    // pairs with the fence in enter_waiting_, either the waiter sees what was
+    // published before the wake up, or it is seen waiting here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_relaxed) == 0) {
+      return;
     }
+    eq_lg_t lg(this->l_);
+    if (idle_mask_ == 0) {
+      return;
+    }
+    waiter* w = idle_[lowest_bit(idle_mask_)];
+    this->unpark_(*w);
+    w->nudged = true;
+    w->cv.notify_one();
+  }
+
+  /**
+   * @brief Count an item going into the local deque of a work stealing worker,
+   * before the push. It stays counted until the item is taken out, so a waiter
+   * can check it before parking. Return the count before.
+  */
+  size_t add_local_pending() {
+    return local_pending_.fetch_add(1, std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief Uncount an item taken out of a local deque, or failed to be pushed.
+   * Return the count before.
+  */
+  size_t remove_local_pending() {
+    return local_pending_.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  /**
+   * @brief Count of the items in the local deques
+  */
+  size_t local_pending() const {
+    return local_pending_.load(std::memory_order_seq_cst);
   }
 
   /**
@@ -249,20 +548,27 @@ public:
   */
   void break_waiter(std::thread::id tid) {
     eq_lg_t lg(this->l_);
-    auto t = pending_threads_.find(tid);
-    if (t == pending_threads_.end()) {
-      return;
+    for (waiter* w = registered_; w != nullptr; w = w->reg_next) {
+      if (w->waiting && w->tid == tid) {
+        this->break_(*w);
+        return;
+      }
     }
-    t->second = 0;
-    cv_.notify_all();
+  }
+
+  /**
+   * @brief Break a waiter slot, its current or next wait returns nullptr
+  */
+  void break_waiter(waiter& w) {
+    eq_lg_t lg(this->l_);
+    this->break_(w);
   }
 
   /**
    * @brief Return the waiting thread count
   */
   size_t waiter_count() const {
-    eq_lg_t lg(this->l_);
-    return pending_threads_.size();
+    return waiting_.load(std::memory_order_acquire);
   }
 
   /**
@@ -280,82 +586,394 @@ protected:
   void break_queue() {
     eq_lg_t lg(this->l_);
     this->st_ = false;
-    // clear all item
+    this->clear_();
+    for (waiter* w = registered_; w != nullptr; w = w->reg_next) {
+      if (w->waiting) {
+        w->cv.notify_one();
+      }
+    }
+  }
+
+  /**
+   * @brief Link an item to its lane and wake up a waiter for it
+  */
+  item_handle push_(item_strong_t&& item, bool front) {
+    size_t prio = item->prio;
+    item_node* n = item_node::of(item.get());
+    eq_lg_t lg(this->l_);
+    if (st_ == false) {
+      return item_handle();
+    }
+    item.release();
+    if (front) {
+      il_[prio - 1].push_front(n);
+    } else {
+      il_[prio - 1].push_back(n);
+    }
+    ++is_;
+    this->update_lane_(prio);
+    this->notify_waiter_(prio);
+    return item_handle{n, n->gen};
+  }
+
+  /**
+   * @brief Give all queued items back to the pool, lock must be held
+  */
+  void clear_() {
     for (size_t i = 0; i < max_priority; ++i) {
-      il_[i].clear();
+      while (!il_[i].empty()) {
+        pool_.release(il_[i].pop_front()->item());
+      }
     }
     is_ = 0;
-    cv_.notify_all();
+    lanes_.store(0, std::memory_order_relaxed);
   }
 
-  item_strong_t pick_up_(size_t t_prio) {
-    size_t highest_prio = 0;
-    size_t higher_waiter_count = 0;
-    size_t higher_item_count = 0;
-    for (auto& pd_th : pending_threads_) {
-      if (pd_th.second > t_prio) {
-        ++higher_waiter_count;
+  /**
+   * @brief Map a waiter's priority to the lane it waits on, [1, max_priority]
+  */
+  static size_t level_of_(size_t priority) {
+    if (priority < 1) return 1;
+    return (priority > max_priority ? max_priority : priority);
+  }
+
+  /**
+   * @brief Mask of the lanes whose level is not lower than the given one
+  */
+  static uint64_t mask_from_(size_t level) {
+    if (level <= 1) return ~(uint64_t)0;
+    if (level > 64) return 0;
+    return (~(uint64_t)0) << (level - 1);
+  }
+
+  item_strong_t wait_(eq_ul_t& ul, waiter& w, size_t priority, const std::function<bool ()>& pred) {
+    this->enter_waiting_(w, priority);
+    item_strong_t r;
+    while (this->should_wait_(w, pred, r)) {
+      this->park_(w);
+      w.cv.wait(ul, [this, &w]() { return !w.idle || this->st_ == false; });
+      this->unpark_(w);
+    }
+    this->leave_waiting_(w);
+    return r;
+  }
+
+  item_strong_t wait_until_(
+    eq_ul_t& ul, waiter& w, size_t priority, const std::function<bool ()>& pred,
+    std::chrono::steady_clock::time_point deadline
+  ) {
+    this->enter_waiting_(w, priority);
+    item_strong_t r;
+    while (this->should_wait_(w, pred, r)) {
+      this->park_(w);
+      // timeout for current waiting oprand
+      bool woken = w.cv.wait_until(ul, deadline, [this, &w]() { return !w.idle || this->st_ == false; });
+      this->unpark_(w);
+      if (!woken) {
+        break;
       }
     }
-    for (size_t base_prio = (t_prio + 1); base_prio <= max_priority; ++base_prio) {
-      higher_item_count += il_[base_prio - 1].size();
-      if (il_[base_prio - 1].size() > 0) {
-        highest_prio = base_prio;
+    this->leave_waiting_(w);
+    return r;
+  }
+
+  /**
+   * @brief Check the state of a waiter with the lock held, try to pick up an item
+   * for it. Return true if the waiter should be parked.
+  */
+  bool should_wait_(waiter& w, const std::function<bool ()>& pred, item_strong_t& r) {
+    // Queue has been broken, return nothing
+    if (this->st_ == false) {
+      return false;
+    }
+    // Thread has been broken, the break is consumed by this wait
+    if (w.broken) {
+      w.broken = false;
+      return false;
+    }
+    if (pred && pred()) {
+      return false;
+    }
+    if (w.nudged) {
+      w.nudged = false;
+      return false;
+    }
+    bool was_signaled = w.signaled;
+    w.signaled = false;
+    if (is_ > 0) {
+      r = this->pick_up_(w.level);
+      if (r) {
+        return false;
+      }
+      // All pending items are reserved for the higher priority waiters, 
+      // pass the signal we got to one of them
+      if (was_signaled) {
+        this->notify_waiter_(max_priority, w.level + 1);
       }
     }
-    size_t pickup_prio = 0;
-    if (
-      (higher_item_count > 0 && higher_waiter_count == 0) || // no higher waiter wait for higher item
-      (higher_item_count > higher_waiter_count * 2) // too many pending higher item
-    ) {
-      pickup_prio = highest_prio;
+    return true;
+  }
+
+  void register_(waiter& w) {
+    if (w.registered) {
+      return;
+    }
+    w.registered = true;
+    w.tid = std::this_thread::get_id();
+    w.reg_prev = nullptr;
+    w.reg_next = registered_;
+    if (registered_ != nullptr) {
+      registered_->reg_prev = &w;
+    }
+    registered_ = &w;
+  }
+
+  void unregister_(waiter& w) {
+    if (!w.registered) {
+      return;
+    }
+    if (w.reg_prev != nullptr) {
+      w.reg_prev->reg_next = w.reg_next;
     } else {
-      // pick the nearest prio item
-      for (size_t base_prio = t_prio; base_prio > 0; --base_prio) {
-        if (il_[base_prio - 1].size() > 0) {
-          pickup_prio = base_prio;
-          break;
+      registered_ = w.reg_next;
+    }
+    if (w.reg_next != nullptr) {
+      w.reg_next->reg_prev = w.reg_prev;
+    }
+    w.reg_prev = w.reg_next = nullptr;
+    w.registered = false;
+  }
+
+  void break_(waiter& w) {
+    w.broken = true;
+    if (w.idle) {
+      this->unpark_(w);
+      w.cv.notify_one();
+    }
+  }
+
+  void enter_waiting_(waiter& w, size_t priority) {
+    w.level = level_of_(priority);
+    w.tid = std::this_thread::get_id();
+    w.waiting = true;
+    if (waiting_count_[w.level - 1]++ == 0) {
+      waiting_mask_ |= ((uint64_t)1 << (w.level - 1));
+    }
+    waiting_.store(waiting_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    // pairs with the fence in wake_waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void leave_waiting_(waiter& w) {
+    // leaving with a signal but without the item, hand the signal over
+    if (w.signaled && is_ > 0) {
+      this->notify_waiter_(max_priority);
+    }
+    w.waiting = false;
+    w.signaled = false;
+    w.nudged = false;
+    if (--waiting_count_[w.level - 1] == 0) {
+      waiting_mask_ &= ~((uint64_t)1 << (w.level - 1));
+    }
+    waiting_.store(waiting_.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Put the waiter to the idle list of its level, it can be signaled from now on
+  */
+  void park_(waiter& w) {
+    size_t idx = w.level - 1;
+    w.idle = true;
+    w.idle_prev = nullptr;
+    w.idle_next = idle_[idx];
+    if (idle_[idx] != nullptr) {
+      idle_[idx]->idle_prev = &w;
+    }
+    idle_[idx] = &w;
+    idle_mask_ |= ((uint64_t)1 << idx);
+  }
+
+  /**
+   * @brief Remove the waiter from the idle list, do nothing if it is not idle
+  */
+  void unpark_(waiter& w) {
+    if (!w.idle) {
+      return;
+    }
+    size_t idx = w.level - 1;
+    if (w.idle_prev != nullptr) {
+      w.idle_prev->idle_next = w.idle_next;
+    } else {
+      idle_[idx] = w.idle_next;
+    }
+    if (w.idle_next != nullptr) {
+      w.idle_next->idle_prev = w.idle_prev;
+    }
+    w.idle_prev = w.idle_next = nullptr;
+    w.idle = false;
+    if (idle_[idx] == nullptr) {
+      idle_mask_ &= ~((uint64_t)1 << idx);
+    }
+  }
+
+  /**
+   * @brief Refresh the non-empty bit of the given lane, lock must be held
+  */
+  void update_lane_(size_t prio) {
+    uint64_t bit = ((uint64_t)1 << (prio - 1));
+    uint64_t lanes = lanes_.load(std::memory_order_relaxed);
+    lanes = (il_[prio - 1].empty() ? (lanes & ~bit) : (lanes | bit));
+    lanes_.store(lanes, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Wake up exactly one idle waiter which is able to handle the item.
+   * Prefer the lowest priority waiter not lower than the item, otherwise
+   * the highest priority waiter.
+   * @param min_level: ignore the waiters whose priority is lower than it
+   * @return false if no waiter is idle
+  */
+  bool notify_waiter_(size_t item_prio, size_t min_level = 1) {
+    uint64_t candidates = idle_mask_ & mask_from_(min_level);
+    if (candidates == 0) {
+      // all waiters are busy, the first one back will pick up the item
+      return false;
+    }
+    uint64_t fit = candidates & mask_from_(item_prio);
+    waiter* w = idle_[fit != 0 ? lowest_bit(fit) : highest_bit(candidates)];
+    this->unpark_(*w);
+    w->signaled = true;
+    w->cv.notify_one();
+    return true;
+  }
+
+  item_strong_t pick_up_(size_t level) {
+    uint64_t lanes = lanes_.load(std::memory_order_relaxed);
+    uint64_t higher_lanes = lanes & mask_from_(level + 1);
+    size_t pickup_prio = 0;
+    if (higher_lanes != 0) {
+      size_t higher_waiter_count = 0;
+      for (uint64_t m = waiting_mask_ & mask_from_(level + 1); m != 0; m &= (m - 1)) {
+        higher_waiter_count += waiting_count_[lowest_bit(m)];
+      }
+      // no higher waiter wait for higher item, or too many pending higher item
+      bool pick_higher = (higher_waiter_count == 0);
+      if (!pick_higher) {
+        size_t higher_item_count = 0;
+        for (uint64_t m = higher_lanes; m != 0 && !pick_higher; m &= (m - 1)) {
+          higher_item_count += il_[lowest_bit(m)].size();
+          pick_higher = (higher_item_count > higher_waiter_count * 2);
         }
       }
-      if (pickup_prio == 0) {
+      if (pick_higher) {
+        pickup_prio = highest_bit(higher_lanes) + 1;
+      }
+    }
+    if (pickup_prio == 0) {
+      // pick the nearest prio item
+      uint64_t lower_lanes = lanes & ~mask_from_(level + 1);
+      if (lower_lanes == 0) {
         // invalidate
         return nullptr;
       }
+      pickup_prio = highest_bit(lower_lanes) + 1;
     }
-    auto ti = il_[pickup_prio - 1].front();
-    il_[pickup_prio - 1].pop_front();
+    item_node* n = il_[pickup_prio - 1].pop_front();
     is_ -= 1;
-    return ti;
+    this->update_lane_(pickup_prio);
+    return this->adopt_item(n->item());
   }
 
 protected:
+  /**
+   * @brief Intrusive list of the queued item nodes of one lane
+  */
+  class item_list {
+  public:
+    bool empty() const { return head_ == nullptr; }
+    size_t size() const { return size_; }
+    void push_back(item_node* n) {
+      n->prev = tail_;
+      n->next = nullptr;
+      if (tail_ != nullptr) tail_->next = n; else head_ = n;
+      tail_ = n;
+      n->queued = true;
+      ++size_;
+    }
+    void push_front(item_node* n) {
+      n->prev = nullptr;
+      n->next = head_;
+      if (head_ != nullptr) head_->prev = n; else tail_ = n;
+      head_ = n;
+      n->queued = true;
+      ++size_;
+    }
+    item_node* pop_front() {
+      item_node* n = head_;
+      this->erase(n);
+      return n;
+    }
+    void erase(item_node* n) {
+      if (n->prev != nullptr) n->prev->next = n->next; else head_ = n->next;
+      if (n->next != nullptr) n->next->prev = n->prev; else tail_ = n->prev;
+      n->prev = n->next = nullptr;
+      n->queued = false;
+      --size_;
+    }
+  protected:
+    item_node*  head_ = nullptr;
+    item_node*  tail_ = nullptr;
+    size_t      size_ = 0;
+  };
+
   /**
    * @brief Status of current queue
   */
   std::atomic_bool st_;
+  /**
+   * @brief Item node pool, nodes are reused without allocation in steady state
+  */
+  item_pool pool_;
   /**
    * @brief Inner item storage
   */
-  std::array<std::list<item_strong_t>, max_priority> il_;
-  // std::list<item_strong_t> il_;
+  std::array<item_list, max_priority> il_;
   /**
    * @brief Inner item size
   */
   size_t is_;
   /**
-   * @brief Mutex for the cv
+   * @brief Bitmap of non-empty lanes, bit (prio - 1) for each priority
+  */
+  std::atomic<uint64_t> lanes_;
+  /**
+   * @brief Mutex for the queue and all waiters
   */
   mutable std::mutex l_;
 
   /**
-   * @brief CV to control event
+   * @brief Items in the local deques of the work stealing workers
   */
-  std::condition_variable cv_;
-
+  std::atomic<size_t> local_pending_;
+  /**
+   * @brief Count of the threads inside wait, readable without the lock
+  */
+  std::atomic<size_t> waiting_;
+  /**
+   * @brief Waiting thread count of each level, and the bitmap of non-zero counts
+  */
+  std::array<size_t, max_priority> waiting_count_;
+  uint64_t waiting_mask_;
+  /**
+   * @brief Parked waiters of each level which can be signaled, and the bitmap
+   * of non-empty lists
+  */
+  std::array<waiter*, max_priority> idle_;
+  uint64_t idle_mask_;
   /**
-   * @brief Pending threads cache
+   * @brief All registered waiter slots
   */
-  std::unordered_map<std::thread::id, size_t> pending_threads_;
+  waiter* registered_;
 };
 
 } // namespace libtq
@@ -0,0 +1,268 @@
+/*
+    task_function.h
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#ifndef LIBTQ_TASK_FUNCTION_H__
+#define LIBTQ_TASK_FUNCTION_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(_WIN32)
+#pragma warning(disable: 4820)
+#pragma warning(disable: 5045)
+#endif
+
+/**
+ * @brief Inline buffer size of unique_function, callables not larger than it
+ * are stored without allocation. Define it before including libtq to change.
+*/
+#ifndef LIBTQ_TASK_INLINE_SIZE
+#define LIBTQ_TASK_INLINE_SIZE    48
+#endif
+
+namespace libtq {
+
+template < typename _Sig, size_t inline_size = LIBTQ_TASK_INLINE_SIZE >
+class unique_function;
+
+/**
+ * @brief Move only callable wrapper with a small inline buffer.
+ * Same usage as std::function, but it never copies the callable, so it can
+ * hold move only captures, and a callable fits in the buffer does not allocate.
+*/
+template < typename _R, typename... _Args, size_t inline_size >
+class unique_function<_R(_Args...), inline_size> {
+  template < typename _F >
+  struct is_callable_ {
+    template < typename _U >
+    static auto check_(int) -> decltype(std::declval<_U&>()(std::declval<_Args>()...), std::true_type());
+    template < typename _U >
+    static std::false_type check_(...);
+    enum { value = decltype(check_<_F>(0))::value };
+  };
+
+  template < typename _F >
+  using enable_if_callable_ = typename std::enable_if<
+    !std::is_same<typename std::decay<_F>::type, unique_function>::value &&
+    is_callable_<typename std::decay<_F>::type>::value
+  >::type;
+
+public:
+  unique_function() noexcept : ops_(nullptr) {}
+  unique_function(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+  template < typename _F, typename = enable_if_callable_<_F> >
+  unique_function(_F&& f) : ops_(nullptr) {
+    this->assign_(std::forward<_F>(f));
+  }
+
+  unique_function(unique_function&& r) noexcept : ops_(nullptr) {
+    this->move_from_(r);
+  }
+
+  ~unique_function() {
+    this->reset();
+  }
+
+  unique_function(const unique_function&) = delete;
+  unique_function& operator = (const unique_function&) = delete;
+
+  unique_function& operator = (unique_function&& r) noexcept {
+    if (this != &r) {
+      this->reset();
+      this->move_from_(r);
+    }
+    return *this;
+  }
+
+  unique_function& operator = (std::nullptr_t) noexcept {
+    this->reset();
+    return *this;
+  }
+
+  template < typename _F, typename = enable_if_callable_<_F> >
+  unique_function& operator = (_F&& f) {
+    this->reset();
+    this->assign_(std::forward<_F>(f));
+    return *this;
+  }
+
+  /**
+   * @brief Invoke the callable, should not be empty
+  */
+  _R operator() (_Args... args) const {
+    return ops_->invoke(const_cast<void*>(static_cast<const void*>(&buf_)), std::forward<_Args>(args)...);
+  }
+
+  explicit operator bool() const noexcept {
+    return ops_ != nullptr;
+  }
+
+  /**
+   * @brief Check if the callable is stored in the inline buffer
+  */
+  bool is_inline() const noexcept {
+    return ops_ != nullptr && ops_->is_inline;
+  }
+
+  /**
+   * @brief Destroy the callable
+  */
+  void reset() noexcept {
+    if (ops_ != nullptr) {
+      ops_->destroy(&buf_);
+      ops_ = nullptr;
+    }
+  }
+
+protected:
+  struct ops_t {
+    _R    (*invoke)(void*, _Args&&...);
+    void  (*move)(void* dst, void* src) noexcept;
+    void  (*destroy)(void*) noexcept;
+    bool  is_inline;
+  };
+
+  template < typename _F >
+  struct fits_inline_ {
+    enum {
+      value = (
+        sizeof(_F) <= inline_size &&
+        alignof(std::max_align_t) % alignof(_F) == 0 &&
+        std::is_nothrow_move_constructible<_F>::value
+      )
+    };
+  };
+
+  template < typename _F >
+  struct inline_ops_ {
+    static _R invoke(void* p, _Args&&... args) {
+      return (*static_cast<_F*>(p))(std::forward<_Args>(args)...);
+    }
+    static void move(void* dst, void* src) noexcept {
+      new (dst) _F(std::move(*static_cast<_F*>(src)));
+      static_cast<_F*>(src)->~_F();
+    }
+    static void destroy(void* p) noexcept {
+      static_cast<_F*>(p)->~_F();
+    }
+    static const ops_t* get() {
+      static const ops_t ops = { &invoke, &move, &destroy, true };
+      return &ops;
+    }
+  };
+
+  template < typename _F >
+  struct heap_ops_ {
+    static _R invoke(void* p, _Args&&... args) {
+      return (**static_cast<_F**>(p))(std::forward<_Args>(args)...);
+    }
+    static void move(void* dst, void* src) noexcept {
+      *static_cast<_F**>(dst) = *static_cast<_F**>(src);
+    }
+    static void destroy(void* p) noexcept {
+      delete *static_cast<_F**>(p);
+    }
+    static const ops_t* get() {
+      static const ops_t ops = { &invoke, &move, &destroy, false };
+      return &ops;
+    }
+  };
+
+  /**
+   * @brief Empty function pointer or std::function makes an empty wrapper
+  */
+  template < typename _F >
+  static bool is_null_(const _F&) { return false; }
+  template < typename _Fr, typename... _Fa >
+  static bool is_null_(_Fr (*f)(_Fa...)) { return f == nullptr; }
+  template < typename _S >
+  static bool is_null_(const std::function<_S>& f) { return !f; }
+
+  template < typename _F >
+  void assign_(_F&& f) {
+    typedef typename std::decay<_F>::type fn_t;
+    if (is_null_(f)) {
+      return;
+    }
+    this->construct_<fn_t>(std::forward<_F>(f), std::integral_constant<bool, fits_inline_<fn_t>::value>());
+  }
+
+  template < typename _Fn, typename _F >
+  void construct_(_F&& f, std::true_type) {
+    new (&buf_) _Fn(std::forward<_F>(f));
+    ops_ = inline_ops_<_Fn>::get();
+  }
+
+  template < typename _Fn, typename _F >
+  void construct_(_F&& f, std::false_type) {
+    *reinterpret_cast<_Fn**>(&buf_) = new _Fn(std::forward<_F>(f));
+    ops_ = heap_ops_<_Fn>::get();
+  }
+
+  void move_from_(unique_function& r) noexcept {
+    if (r.ops_ == nullptr) {
+      return;
+    }
+    r.ops_->move(&buf_, &r.buf_);
+    ops_ = r.ops_;
+    r.ops_ = nullptr;
+  }
+
+protected:
+  typename std::aligned_storage<
+    (inline_size < sizeof(void*) ? sizeof(void*) : inline_size),
+    alignof(std::max_align_t)
+  >::type buf_;
+  const ops_t* ops_;
+};
+
+template < typename _R, typename... _Args, size_t inline_size >
+inline bool operator == (const unique_function<_R(_Args...), inline_size>& f, std::nullptr_t) noexcept {
+  return !f;
+}
+template < typename _R, typename... _Args, size_t inline_size >
+inline bool operator != (const unique_function<_R(_Args...), inline_size>& f, std::nullptr_t) noexcept {
+  return (bool)f;
+}
+
+typedef unique_function<void()>   unique_task;
+
+} // namespace libtq
+
+#endif
+
+// Push Chen
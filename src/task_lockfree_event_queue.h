@@ -0,0 +1,694 @@
+/*
+    task_lockfree_event_queue.h
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#ifndef LIBTQ_TASK_LOCKFREE_EVENT_QUEUE_H__
+#define LIBTQ_TASK_LOCKFREE_EVENT_QUEUE_H__
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+#if defined(_WIN32)
+#pragma warning(disable: 4820)
+#pragma warning(disable: 5045)
+#endif
+
+namespace libtq {
+
+/**
+ * @brief Bounded multiple producer multiple consumer ring, Dmitry Vyukov's algorithm.
+ * Every cell carries a sequence number, so producers and consumers only contend
+ * on their own position counter.
+ * @param _Ty: should be cheap to move, like a pointer
+*/
+template < typename _Ty >
+class mpmc_ring {
+public:
+  /**
+   * @brief Create the ring, capacity will be rounded up to the power of 2
+  */
+  explicit mpmc_ring(size_t capacity) {
+    size_t c = 2;
+    while (c < capacity) c <<= 1;
+    mask_ = c - 1;
+    cells_.reset(new cell[c]);
+    for (size_t i = 0; i < c; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+  mpmc_ring(const mpmc_ring&) = delete;
+  mpmc_ring(mpmc_ring&&) = delete;
+  mpmc_ring& operator= (const mpmc_ring&) = delete;
+  mpmc_ring& operator= (mpmc_ring&&) = delete;
+
+  /**
+   * @brief Push to the tail, return false when the ring is full
+  */
+  bool try_push(_Ty&& v) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &cells_[pos & mask_];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    c->data = std::move(v);
+    c->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Pop from the head, return false when the ring is empty
+  */
+  bool try_pop(_Ty& v) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &cells_[pos & mask_];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    v = std::move(c->data);
+    c->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Item count, only a hint when other threads are working on the ring
+  */
+  size_t size_approx() const {
+    size_t e = enqueue_pos_.load(std::memory_order_acquire);
+    size_t d = dequeue_pos_.load(std::memory_order_acquire);
+    return (e > d ? e - d : 0);
+  }
+
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+protected:
+  struct cell {
+    std::atomic<size_t>   seq;
+    _Ty                   data;
+  };
+  enum { k_cache_line = 64 };
+
+  std::unique_ptr<cell[]>   cells_;
+  size_t                    mask_;
+  char                      pad0_[k_cache_line];
+  std::atomic<size_t>       enqueue_pos_;
+  char                      pad1_[k_cache_line - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t>       dequeue_pos_;
+  char                      pad2_[k_cache_line - sizeof(std::atomic<size_t>)];
+};
+
+/**
+ * @brief Lock free event queue, same usage as event_queue but backed by
+ * a bounded mpmc ring for each priority level. Posting and picking up items
+ * never take the lock, the mutex is only used to park and wake idle waiters.
+ * A wait without a registered waiter slot also locks to add and remove its slot.
+ * Items live in a node pool allocated once, so the queue refuses new items
+ * when it is full.
+ * @param max_priority: max supported priority level in this queue, 0 = broken
+*/
+template< typename _Ty, size_t max_priority = 5, size_t normal_priority = 2 >
+class lockfree_event_queue {
+public:
+  struct item_wrapper {
+    item_wrapper(_Ty&& r, size_t p) : prio(p), i(std::move(r)) {}
+    size_t prio;
+    _Ty i;
+  };
+  /**
+   * @brief Give the item node back to the pool when the picked up item is released
+  */
+  struct item_recycler {
+    lockfree_event_queue* q;
+    void operator() (item_wrapper* p) const {
+      q->recycle_(p);
+    }
+  };
+  typedef std::unique_ptr<item_wrapper, item_recycler>  item_strong_t;
+  typedef std::lock_guard<std::mutex>                   eq_lg_t;
+  typedef std::unique_lock<std::mutex>                  eq_ul_t;
+
+  /**
+   * @brief Waiting slot of a thread. A long living thread registers its slot
+   * once and reuses it, so a wait with a slot only takes the lock to sleep.
+  */
+  class waiter {
+  public:
+    waiter() = default;
+    waiter(const waiter&) = delete;
+    waiter& operator= (const waiter&) = delete;
+  private:
+    friend class lockfree_event_queue;
+    // the wait in progress, or the last one
+    std::atomic<uint64_t>     epoch{0};
+    std::atomic<bool>         waiting{false};
+    std::thread::id           tid;
+    bool                      registered = false;
+    // the fields below are guarded by the lock
+    bool                      broken = false;
+    uint64_t                  broken_epoch = 0;
+    waiter*                   reg_prev = nullptr;
+    waiter*                   reg_next = nullptr;
+  };
+
+public:
+  /**
+   * @brief C'str, capacity is the max item count in the queue
+  */
+  explicit lockfree_event_queue(size_t capacity = 1024) : 
+    st_(true), nodes_(new node_t[capacity]), free_(capacity)
+  {
+    for (size_t i = 0; i < max_priority; ++i) {
+      il_[i].reset(new mpmc_ring<item_wrapper*>(capacity));
+    }
+    for (size_t i = 0; i < capacity; ++i) {
+      node_t* n = &nodes_[i];
+      free_.try_push(std::move(n));
+    }
+    for (auto& c : sleeper_count_) {
+      c.store(0, std::memory_order_relaxed);
+    }
+    waiting_.store(0, std::memory_order_relaxed);
+  }
+  lockfree_event_queue(const lockfree_event_queue&) = delete;
+  lockfree_event_queue(lockfree_event_queue&&) = delete;
+  lockfree_event_queue& operator= (const lockfree_event_queue&) = delete;
+  lockfree_event_queue& operator= (lockfree_event_queue&&) = delete;
+
+  /**
+   * @brief D'str, will force to break all waiting thread,
+   * all picked up items must be released before
+  */
+  ~lockfree_event_queue() {
+    this->break_queue();
+    while (this->waiter_count() > 0) {
+      std::this_thread::yield();
+    }
+    this->cancel_all();
+  }
+
+public:
+  /**
+   * @brief Block and wait for item, unless break the queue
+   * @remarks pred is checked when entering and every time the waiter is woken up
+   * @return the item, or nullptr
+  */
+  item_strong_t wait(size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    return this->wait_unslotted_(nullptr, priority, pred);
+  }
+
+  /**
+   * @brief Block and wait for item on a registered waiter slot
+  */
+  item_strong_t wait(waiter& w, size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    if (!w.registered) {
+      return item_strong_t(nullptr, item_recycler{this});
+    }
+    return this->wait_slotted_(w, nullptr, priority, pred);
+  }
+
+  /**
+   * @brief Block and wait for item till timeout or queue has been broken
+   * @return the item or nullptr
+  */
+  item_strong_t wait_for(std::chrono::nanoseconds timeout, size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return this->wait_unslotted_(&deadline, priority, pred);
+  }
+
+  /**
+   * @brief Block and wait for item on a registered waiter slot till timeout
+  */
+  item_strong_t wait_for(std::chrono::nanoseconds timeout, waiter& w, size_t priority = normal_priority, std::function<bool ()> pred = nullptr) {
+    if (!w.registered) {
+      return item_strong_t(nullptr, item_recycler{this});
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return this->wait_slotted_(w, &deadline, priority, pred);
+  }
+
+  /**
+   * @brief Register a waiter slot to the queue, the slot must be unregistered
+   * before it is destroyed unless the queue has gone first
+  */
+  void register_waiter(waiter& w) {
+    eq_lg_t lg(this->l_);
+    this->register_(w);
+  }
+
+  /**
+   * @brief Unregister a waiter slot, do nothing if the slot is not registered
+  */
+  void unregister_waiter(waiter& w) {
+    eq_lg_t lg(this->l_);
+    this->unregister_(w);
+  }
+
+  /**
+   * @brief Add item to the end of the queue
+   * @return false if the queue is full or has been broken
+  */
+  bool emplace_back(_Ty&& item, size_t priority = normal_priority) {
+    // a broken item should not be added to the queue
+    if (priority <= 0 || priority > max_priority) {
+      return false;
+    }
+    if (st_ == false) {
+      return false;
+    }
+    node_t* n = nullptr;
+    if (!free_.try_pop(n)) {
+      return false;
+    }
+    item_wrapper* w = new (n) item_wrapper(std::move(item), priority);
+    this->push_node_(*il_[priority - 1], w);
+    // Pairs with the fence in wait_until_, either the waiter sees the item
+    // or we see the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    this->notify_waiter_(priority);
+    return true;
+  }
+
+  /**
+   * @brief Cancel all pending item
+  */
+  void cancel_all() {
+    for (size_t p = 0; p < max_priority; ++p) {
+      item_wrapper* w = nullptr;
+      while (il_[p]->try_pop(w)) {
+        this->recycle_(w);
+      }
+    }
+  }
+
+  /**
+   * @brief Break the current wait of a thread, sleeping or about to sleep.
+   * Nothing happens if the thread is not waiting on this queue.
+  */
+  void break_waiter(std::thread::id tid) {
+    eq_lg_t lg(this->l_);
+    for (waiter* w = registered_; w != nullptr; w = w->reg_next) {
+      // pairs with the store in wait_until_, a wait seen here has its epoch
+      if (w->tid == tid && w->waiting.load(std::memory_order_seq_cst)) {
+        w->broken_epoch = w->epoch.load(std::memory_order_relaxed);
+        this->notify_all_();
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief Break a waiter slot, its current or next wait returns nullptr
+  */
+  void break_waiter(waiter& w) {
+    eq_lg_t lg(this->l_);
+    w.broken = true;
+    this->notify_all_();
+  }
+
+  /**
+   * @brief Return the count of the threads inside wait
+  */
+  size_t waiter_count() const {
+    return waiting_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Item count in queue
+  */
+  size_t pending_count() const {
+    size_t c = 0;
+    for (size_t p = 0; p < max_priority; ++p) {
+      c += il_[p]->size_approx();
+    }
+    return c;
+  }
+
+protected:
+  typedef typename std::aligned_storage<sizeof(item_wrapper), alignof(item_wrapper)>::type node_t;
+
+  /**
+   * @brief Tell all waiting thread to stop
+  */
+  void break_queue() {
+    eq_lg_t lg(this->l_);
+    this->st_ = false;
+    this->notify_all_();
+  }
+
+  /**
+   * @brief Wake up all sleeping waiters to check their state, lock must be held
+  */
+  void notify_all_() {
+    for (auto& cv : cv_) {
+      cv.notify_all();
+    }
+  }
+
+  /**
+   * @brief Check and consume a break of the wait, lock must be held
+  */
+  static bool take_break_(waiter& w, uint64_t epoch) {
+    if (w.broken) {
+      w.broken = false;
+      return true;
+    }
+    return w.broken_epoch == epoch;
+  }
+
+  /**
+   * @brief Waiters are grouped by their priority level, clamp to the lanes
+  */
+  static size_t level_of_(size_t priority) {
+    return (priority > max_priority ? max_priority : priority);
+  }
+
+  void recycle_(item_wrapper* w) {
+    w->~item_wrapper();
+    node_t* n = reinterpret_cast<node_t*>(w);
+    this->push_node_(free_, n);
+  }
+
+  /**
+   * @brief A ring never holds more nodes than the pool, a failed push only
+   * means a consumer has claimed the cell but not released it yet
+  */
+  template < typename _Node >
+  static void push_node_(mpmc_ring<_Node*>& ring, _Node* n) {
+    while (!ring.try_push(std::move(n))) {
+      std::this_thread::yield();
+    }
+  }
+
+  void register_(waiter& w) {
+    if (w.registered) {
+      return;
+    }
+    w.registered = true;
+    w.tid = std::this_thread::get_id();
+    w.reg_prev = nullptr;
+    w.reg_next = registered_;
+    if (registered_ != nullptr) {
+      registered_->reg_prev = &w;
+    }
+    registered_ = &w;
+  }
+
+  void unregister_(waiter& w) {
+    if (!w.registered) {
+      return;
+    }
+    if (w.reg_prev != nullptr) {
+      w.reg_prev->reg_next = w.reg_next;
+    } else {
+      registered_ = w.reg_next;
+    }
+    if (w.reg_next != nullptr) {
+      w.reg_next->reg_prev = w.reg_prev;
+    }
+    w.reg_prev = w.reg_next = nullptr;
+    w.registered = false;
+  }
+
+  /**
+   * @brief Wait on a slot living only for this call. The waiting count covers
+   * the unregister so the d'tor never frees the lock under it
+  */
+  item_strong_t wait_unslotted_(
+    const std::chrono::steady_clock::time_point* deadline, 
+    size_t priority, const std::function<bool ()>& pred
+  ) {
+    waiting_.fetch_add(1, std::memory_order_relaxed);
+    waiter w;
+    {
+      eq_lg_t lg(this->l_);
+      this->register_(w);
+    }
+    item_strong_t r = this->wait_until_(w, deadline, priority, pred);
+    {
+      eq_lg_t lg(this->l_);
+      this->unregister_(w);
+    }
+    waiting_.fetch_sub(1, std::memory_order_release);
+    return r;
+  }
+
+  item_strong_t wait_slotted_(
+    waiter& w, const std::chrono::steady_clock::time_point* deadline, 
+    size_t priority, const std::function<bool ()>& pred
+  ) {
+    waiting_.fetch_add(1, std::memory_order_relaxed);
+    item_strong_t r = this->wait_until_(w, deadline, priority, pred);
+    waiting_.fetch_sub(1, std::memory_order_release);
+    return r;
+  }
+
+  /**
+   * @brief Every wait on a slot gets a new epoch, a break by thread id is
+   * tagged with the epoch so it never leaks into a later wait
+  */
+  item_strong_t wait_until_(
+    waiter& w, const std::chrono::steady_clock::time_point* deadline, 
+    size_t priority, const std::function<bool ()>& pred
+  ) {
+    uint64_t epoch = w.epoch.load(std::memory_order_relaxed) + 1;
+    w.epoch.store(epoch, std::memory_order_relaxed);
+    w.waiting.store(true, std::memory_order_seq_cst);
+    item_strong_t r = this->wait_loop_(w, epoch, deadline, priority, pred);
+    w.waiting.store(false, std::memory_order_release);
+    return r;
+  }
+
+  item_strong_t wait_loop_(
+    waiter& w, uint64_t epoch, const std::chrono::steady_clock::time_point* deadline, 
+    size_t priority, const std::function<bool ()>& pred
+  ) {
+    size_t level = level_of_(priority);
+    bool woken = false;
+    while (true) {
+      if (this->st_ == false) {
+        return item_strong_t(nullptr, item_recycler{this});
+      }
+      if (pred && pred()) {
+        return item_strong_t(nullptr, item_recycler{this});
+      }
+      item_wrapper* item = this->pick_up_(level);
+      if (item != nullptr) {
+        return item_strong_t(item, item_recycler{this});
+      }
+      eq_ul_t ul(this->l_);
+      // broken after the checks above, or before sleeping again
+      if (take_break_(w, epoch)) {
+        return item_strong_t(nullptr, item_recycler{this});
+      }
+      if (woken && this->higher_pending_(level)) {
+        // All pending items are reserved for the higher priority waiters
+        this->notify_level_(max_priority, level + 1);
+      }
+      sleeper_count_[level].fetch_add(1, std::memory_order_relaxed);
+      // Pairs with the fence in emplace_back
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool timeout = false;
+      bool busy = this->can_pick_up_(level);
+      if (!busy && this->st_ == true) {
+        if (deadline == nullptr) {
+          cv_[level].wait(ul);
+        } else {
+          timeout = (cv_[level].wait_until(ul, *deadline) == std::cv_status::timeout);
+        }
+      }
+      bool broken = take_break_(w, epoch);
+      sleeper_count_[level].fetch_sub(1, std::memory_order_relaxed);
+      if (busy) {
+        // A producer is still writing the item we saw, let it finish
+        ul.unlock();
+        std::this_thread::yield();
+      }
+      if (broken || timeout) {
+        return item_strong_t(nullptr, item_recycler{this});
+      }
+      woken = true;
+    }
+  }
+
+  /**
+   * @brief Wake up one sleeping waiter for the item, only lock when
+   * someone is sleeping
+  */
+  void notify_waiter_(size_t item_prio) {
+    bool has_sleeper = false;
+    for (const auto& c : sleeper_count_) {
+      if (c.load(std::memory_order_relaxed) > 0) {
+        has_sleeper = true;
+        break;
+      }
+    }
+    if (!has_sleeper) {
+      return;
+    }
+    eq_lg_t lg(this->l_);
+    this->notify_level_(item_prio, 0);
+  }
+
+  /**
+   * @brief Wake up one waiter at the lowest level not lower than the item,
+   * otherwise at the highest level. Lock must be held.
+  */
+  void notify_level_(size_t item_prio, size_t min_level) {
+    for (size_t l = (item_prio > min_level ? item_prio : min_level); l <= max_priority; ++l) {
+      if (sleeper_count_[l].load(std::memory_order_relaxed) > 0) {
+        cv_[l].notify_one();
+        return;
+      }
+    }
+    for (size_t l = item_prio; l > min_level && l > 0; --l) {
+      if (sleeper_count_[l - 1].load(std::memory_order_relaxed) > 0) {
+        cv_[l - 1].notify_one();
+        return;
+      }
+    }
+  }
+
+  bool higher_pending_(size_t t_prio) const {
+    for (size_t l = t_prio + 1; l <= max_priority; ++l) {
+      if (il_[l - 1]->size_approx() > 0) return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Same pick up strategy as event_queue, counters are only hints.
+   * Pick the higher priority item if no higher waiter is sleeping or 
+   * too many higher item pending, otherwise the nearest priority item.
+  */
+  bool prefer_higher_(size_t t_prio) const {
+    size_t higher_waiter_count = 0;
+    size_t higher_item_count = 0;
+    for (size_t l = t_prio + 1; l <= max_priority; ++l) {
+      higher_waiter_count += sleeper_count_[l].load(std::memory_order_relaxed);
+      higher_item_count += il_[l - 1]->size_approx();
+    }
+    return (
+      (higher_item_count > 0 && higher_waiter_count == 0) ||
+      (higher_item_count > higher_waiter_count * 2)
+    );
+  }
+
+  bool can_pick_up_(size_t t_prio) const {
+    if (this->prefer_higher_(t_prio)) {
+      return true;
+    }
+    for (size_t p = t_prio; p > 0; --p) {
+      if (il_[p - 1]->size_approx() > 0) return true;
+    }
+    return false;
+  }
+
+  item_wrapper* pick_up_(size_t t_prio) {
+    item_wrapper* w = nullptr;
+    if (this->prefer_higher_(t_prio)) {
+      for (size_t p = max_priority; p > t_prio; --p) {
+        if (il_[p - 1]->try_pop(w)) return w;
+      }
+    }
+    for (size_t p = t_prio; p > 0; --p) {
+      if (il_[p - 1]->try_pop(w)) return w;
+    }
+    return nullptr;
+  }
+
+protected:
+  /**
+   * @brief Status of current queue
+  */
+  std::atomic_bool st_;
+  /**
+   * @brief Item node pool and the free list
+  */
+  std::unique_ptr<node_t[]> nodes_;
+  mpmc_ring<node_t*> free_;
+  /**
+   * @brief Inner item storage, one ring for each priority
+  */
+  std::array<std::unique_ptr<mpmc_ring<item_wrapper*>>, max_priority> il_;
+  /**
+   * @brief Sleeping waiter count of each priority level
+  */
+  std::array<std::atomic<size_t>, max_priority + 1> sleeper_count_;
+  /**
+   * @brief Mutex for the sleep/wake path
+  */
+  mutable std::mutex l_;
+  std::array<std::condition_variable, max_priority + 1> cv_;
+  /**
+   * @brief All registered waiter slots, and the count of the threads inside wait
+  */
+  waiter*                   registered_ = nullptr;
+  std::atomic<size_t>       waiting_;
+};
+
+} // namespace libtq
+
+#endif
+
+// Push Chen
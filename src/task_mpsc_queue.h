@@ -0,0 +1,148 @@
+/*
+    task_mpsc_queue.h
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#ifndef LIBTQ_TASK_MPSC_QUEUE_H__
+#define LIBTQ_TASK_MPSC_QUEUE_H__
+
+#include <atomic>
+#include <thread>
+
+#if defined(_WIN32)
+#pragma warning(disable: 4820)
+#pragma warning(disable: 5045)
+#endif
+
+namespace libtq {
+
+/**
+ * @brief Link of a node in mpsc_queue
+*/
+struct mpsc_hook {
+  std::atomic<mpsc_hook*> next{nullptr};
+};
+
+/**
+ * @brief Intrusive unbounded multiple producer single consumer queue,
+ * Dmitry Vyukov's algorithm. A push is one exchange, never blocks.
+ * Only one thread can pop at a time, the consumer role can move between
+ * threads when the hand over is synchronized by the caller, usually with
+ * a counter of the pushed nodes.
+ * @param _Node: should derive from mpsc_hook
+*/
+template < typename _Node >
+class mpsc_queue {
+public:
+  mpsc_queue() : head_(&stub_), tail_(&stub_) {}
+  mpsc_queue(const mpsc_queue&) = delete;
+  mpsc_queue(mpsc_queue&&) = delete;
+  mpsc_queue& operator= (const mpsc_queue&) = delete;
+  mpsc_queue& operator= (mpsc_queue&&) = delete;
+
+  /**
+   * @brief Any thread, push to the tail
+  */
+  void push(_Node* n) {
+    this->push_(static_cast<mpsc_hook*>(n));
+  }
+
+  /**
+   * @brief Any thread, push a chain of nodes linked by the caller, first to last,
+   * with one exchange
+  */
+  void push_chain(_Node* first, _Node* last) {
+    mpsc_hook* l = static_cast<mpsc_hook*>(last);
+    l->next.store(nullptr, std::memory_order_relaxed);
+    mpsc_hook* prev = head_.exchange(l, std::memory_order_acq_rel);
+    prev->next.store(static_cast<mpsc_hook*>(first), std::memory_order_release);
+  }
+
+  /**
+   * @brief Consumer only, pop from the head, return nullptr when empty.
+   * Wait for a producer which is in the middle of a push.
+  */
+  _Node* pop() {
+    mpsc_hook* tail = tail_;
+    mpsc_hook* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        if (head_.load(std::memory_order_acquire) == &stub_) {
+          return nullptr;
+        }
+        // a producer has taken the head but not linked yet
+        while ((next = tail->next.load(std::memory_order_acquire)) == nullptr) {
+          std::this_thread::yield();
+        }
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<_Node*>(tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      while ((next = tail->next.load(std::memory_order_acquire)) == nullptr) {
+        std::this_thread::yield();
+      }
+      tail_ = next;
+      return static_cast<_Node*>(tail);
+    }
+    // tail is the last one, put the stub behind it so it can be taken
+    this->push_(&stub_);
+    while ((next = tail->next.load(std::memory_order_acquire)) == nullptr) {
+      std::this_thread::yield();
+    }
+    tail_ = next;
+    return static_cast<_Node*>(tail);
+  }
+
+protected:
+  void push_(mpsc_hook* n) {
+    n->next.store(nullptr, std::memory_order_relaxed);
+    mpsc_hook* prev = head_.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+  }
+
+protected:
+  std::atomic<mpsc_hook*>   head_;
+  char                      pad_[64 - sizeof(std::atomic<mpsc_hook*>)];
+  mpsc_hook*                tail_;
+  mpsc_hook                 stub_;
+};
+
+} // namespace libtq
+
+#endif
+
+// Push Chen
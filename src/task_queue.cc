@@ -30,6 +30,8 @@ SOFTWARE.
 */
 
 #include "task_queue.h"
+#include "task_clock.h"
+#include "task_timer.h"
 
 namespace libtq {
 
@@ -82,6 +84,277 @@ protected:
   mutable std::shared_ptr<state_semaphore> p_ss_;
 };
 
+/**
+ * @brief Recycles the task nodes posted from one thread. Only the owner
+ * thread takes nodes, any thread gives them back with a lock free push.
+ * When the owner thread exits, the cache is parked and adopted by the
+ * next thread which posts a task.
+*/
+class task_node_cache {
+public:
+  typedef task_queue_impl::task_node node_t;
+  enum { k_max_cached = 256 };
+
+  /**
+   * @brief The cache of the calling thread
+  */
+  static task_node_cache* local() {
+    static thread_local holder_ h;
+    return h.cache;
+  }
+
+  /**
+   * @brief Owner thread only
+  */
+  node_t* acquire() {
+    if (free_ == nullptr) {
+      this->refill_();
+    }
+    node_t* n = free_;
+    if (n == nullptr) {
+      n = new node_t;
+      n->cache = this;
+      return n;
+    }
+    free_ = n->free_next;
+    n->next.store(nullptr, std::memory_order_relaxed);
+    return n;
+  }
+
+  /**
+   * @brief Any thread, the task in the node should already be destroied
+  */
+  void release(node_t* n) {
+    node_t* head = returned_.load(std::memory_order_relaxed);
+    do {
+      n->free_next = head;
+    } while (!returned_.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+protected:
+  task_node_cache() : free_(nullptr), returned_(nullptr) {}
+
+  /**
+   * @brief Take the returned nodes, keep at most k_max_cached of them
+  */
+  void refill_() {
+    node_t* n = returned_.exchange(nullptr, std::memory_order_acquire);
+    size_t count = 0;
+    while (n != nullptr) {
+      node_t* next = n->free_next;
+      if (count < k_max_cached) {
+        n->free_next = free_;
+        free_ = n;
+        ++count;
+      } else {
+        delete n;
+      }
+      n = next;
+    }
+  }
+
+  /**
+   * @brief Caches of the exited threads, never destroied, the nodes
+   * still in flight can always be given back
+  */
+  static std::mutex& parked_lock_() {
+    static std::mutex* l = new std::mutex;
+    return *l;
+  }
+  static std::vector<task_node_cache*>& parked_() {
+    static std::vector<task_node_cache*>* p = new std::vector<task_node_cache*>;
+    return *p;
+  }
+
+  struct holder_ {
+    task_node_cache* cache;
+    holder_() : cache(nullptr) {
+      std::lock_guard<std::mutex> _(parked_lock_());
+      if (parked_().empty()) {
+        cache = new task_node_cache;
+      } else {
+        cache = parked_().back();
+        parked_().pop_back();
+      }
+    }
+    ~holder_() {
+      std::lock_guard<std::mutex> _(parked_lock_());
+      parked_().push_back(cache);
+    }
+  };
+
+protected:
+  node_t*               free_;
+  std::atomic<node_t*>  returned_;
+};
+
+task_queue_impl::task_node* task_queue_impl::acquire_node() {
+  return task_node_cache::local()->acquire();
+}
+
+void task_queue_impl::release_node(task_node* n) {
+  n->t = task();
+  n->cache->release(n);
+}
+
+task_queue_impl::~task_queue_impl() {
+  // nobody else can pop now
+  while (task_node* n = head_tq.pop()) {
+    release_node(n);
+  }
+  while (task_node* n = tq.pop()) {
+    release_node(n);
+  }
+}
+
+/**
+ * @brief Take the next task which is not cancelled into t, consumer only.
+ * @return false if nothing left, pending has gone back to 0
+*/
+bool task_queue_impl::take_next(std::shared_ptr<task_queue_impl>&& impl, task& t) {
+  while (true) {
+    task_node* n = impl->head_tq.pop();
+    if (n == nullptr) {
+      n = impl->tq.pop();
+    }
+    if (n == nullptr) {
+      // pending is only increased after the push, should not be here
+      return false;
+    }
+    if (n->epoch < impl->epoch.load(std::memory_order_acquire)) {
+      // cancelled
+      release_node(n);
+      if (impl->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        return false;
+      }
+      continue;
+    }
+    t = std::move(n->t);
+    release_node(n);
+    // the task keeps the queue alive till it is done
+    t.owner = std::move(impl);
+    return true;
+  }
+}
+
+/**
+ * @brief Take the next task and hand it to the event queue.
+ * Only the thread which changes pending from 0, or finishes a task while
+ * pending is still more than 1 can call it, so there is one consumer at a time.
+*/
+void task_queue_impl::dispatch_next(std::shared_ptr<task_queue_impl>&& impl) {
+  task t;
+  while (take_next(std::move(impl), t)) {
+    if (auto seq = t.owner->related_eq.lock()) {
+      auto priority = (size_t)t.owner->priority;
+      worker::dispatch(*seq, std::move(t), priority);
+      return;
+    }
+    // nowhere to run, drop it
+    impl = std::move(t.owner);
+    if (impl->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      return;
+    }
+  }
+}
+
+#if LIBTQ_TRACE_LEVEL >= 3
+/**
+ * @brief Bucket of a duration in the log2 histograms
+*/
+static size_t histogram_bucket_(duration_t d) {
+  uint64_t ns = (d.count() > 0 ? (uint64_t)d.count() : 0);
+  size_t b = 0;
+  while (ns > 1 && b + 1 < task_trace_histogram::k_buckets) {
+    ns >>= 1;
+    ++b;
+  }
+  return b;
+}
+#endif
+
+/**
+ * @brief Record the trace of a done task by the trace level, writer only
+*/
+void task_queue_impl::record_trace_(const task& t) {
+  this->reclaim_trace_rings_();
+#if LIBTQ_TRACE_LEVEL >= 1
+  int level = tracing.load(std::memory_order_relaxed);
+  if (level == (int)trace_level::k_off) {
+    return;
+  }
+  trace_ring* ring = recent_trace.load(std::memory_order_acquire);
+#if LIBTQ_TRACE_LEVEL >= 2
+  if (level >= (int)trace_level::k_timestamps) {
+    ring->push(t);
+  } else
+#endif
+  {
+    // the times of the task are not taken
+    task_trace_item item = {};
+    item.loc = t.loc;
+    ring->push(item);
+  }
+#if LIBTQ_TRACE_LEVEL >= 3
+  // a task posted before the level was raised has no post time
+  if (
+    level >= (int)trace_level::k_histogram &&
+    t.post_time != task_time_t() && t.begin_time != task_time_t()
+  ) {
+    // single writer, no read-modify-write needed
+    auto& w = wait_hist[histogram_bucket_(t.begin_time - t.post_time)];
+    w.store(w.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    auto& r = run_hist[histogram_bucket_(t.end_time - t.begin_time)];
+    r.store(r.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+#endif
+#else
+  (void)t;
+#endif
+}
+
+/**
+ * @brief Free the retired trace rings, writer only
+*/
+void task_queue_impl::reclaim_trace_rings_() {
+  if (!trace_retired.load(std::memory_order_acquire)) {
+    return;
+  }
+  // never block the writer, a reader or a resize holds it, try again next task
+  std::unique_lock<std::mutex> ul(trace_l, std::try_to_lock);
+  if (!ul.owns_lock()) {
+    return;
+  }
+  trace_rings.erase(trace_rings.begin(), trace_rings.end() - 1);
+  trace_retired.store(false, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Called by the worker after a task of the queue is done, record the trace.
+ * If keep_running, the next task is moved into t for the worker to run in place,
+ * otherwise the next task is handed to the event queue.
+ * @return true if t is the next task to run
+*/
+bool task_queue_impl::task_done(task& t, bool keep_running) {
+  std::shared_ptr<task_queue_impl> impl = std::move(t.owner);
+  if (!impl || impl->valid == false) {
+    // already break the task_queue
+    return false;
+  }
+  // one task of the queue is done at a time, the pending counter hands the
+  // writer role of the ring over to the next one
+  impl->record_trace_(t);
+  if (impl->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // nothing more
+    return false;
+  }
+  if (keep_running) {
+    return take_next(std::move(impl), t);
+  }
+  dispatch_next(std::move(impl));
+  return false;
+}
+
 /**
  * @brief Force create task queue with shared ptr
 */
@@ -98,12 +371,22 @@ std::shared_ptr<task_queue> task_queue::create(
 task_queue::task_queue(eq_wt related_eq, wg_wt related_wg, thread_priority priority)
   : impl_(new task_queue_impl)
 { 
-  impl_->running = false;
+  impl_->pending = 0;
+  impl_->epoch = 0;
   impl_->valid = true;
   impl_->related_eq = related_eq;
   impl_->related_wg = related_wg;
   impl_->priority = priority;
-  impl_->keep_recent_count = 100;
+  impl_->trace_rings.emplace_back(new trace_ring(100));
+  impl_->recent_trace = impl_->trace_rings.back().get();
+  impl_->trace_retired = false;
+  impl_->tracing = (int)(LIBTQ_TRACE_LEVEL < 2 ? (trace_level)LIBTQ_TRACE_LEVEL : trace_level::k_timestamps);
+  for (size_t i = 0; i < task_trace_histogram::k_buckets; ++i) {
+    impl_->wait_hist[i] = 0;
+    impl_->run_hist[i] = 0;
+  }
+  impl_->run_budget_count = 64;
+  impl_->run_budget_slice = std::chrono::microseconds(200);
 }
 
 /**
@@ -117,14 +400,9 @@ task_queue::~task_queue() {
  * @brief Cancel all task
 */
 void task_queue::cancel() {
-  std::lock_guard<std::mutex> _(impl_->lock);
-  if (impl_->running) {
-    while (impl_->tq.size() > 1) {
-      impl_->tq.pop_back();
-    }
-  } else {
-    impl_->tq.clear();
-  }
+  // the pending tasks are dropped when they are taken, 
+  // the running one is not affected
+  impl_->epoch.fetch_add(1, std::memory_order_acq_rel);
 }
 
 /**
@@ -139,59 +417,82 @@ void task_queue::break_queue() {
 */
 void task_queue::post_task(task_location loc, task_t t, int direction) {
   if (!impl_->valid) return;
-  task st;
-  st.t = t;
-  st.loc = loc;
-  st.post_time = std::chrono::steady_clock::now();
-
-  std::weak_ptr<task_queue_impl> w_tq_impl = this->impl_;
-  st.after = [w_tq_impl](task* ptask) {
-    auto impl = w_tq_impl.lock();
-    if (!impl || impl->valid == false) {
-      // already destroy or break the task_queue
-      return;
-    }
-    std::lock_guard<std::mutex> _(impl->lock);
-    
-    // Save the trace info into the list
-    task_trace_item tracer;
-    tracer.loc = ptask->loc;
-    tracer.begin_time = ptask->begin_time;
-    tracer.end_time = ptask->end_time;
-    tracer.post_time = ptask->post_time;
-    impl->recent_trace.push(std::move(tracer));
-    if (impl->recent_trace.size() > impl->keep_recent_count) {
-      impl->recent_trace.pop();
-    }
-    
-    impl->tq.pop_front();
-    if (impl->tq.size() > 0) {
-      if (auto seq = impl->related_eq.lock()) {
-        // still running, no need to change
-        seq->emplace_back(std::move(impl->tq.front()), (size_t)impl->priority);
-      } else {
-        impl->running = false;
-      }
+  auto n = task_queue_impl::acquire_node();
+  n->t.t = std::move(t);
+  n->t.loc = loc;
+  n->t.post_time = (impl_->has_timestamps() ? task_now() : task_time_t());
+  n->epoch = impl_->epoch.load(std::memory_order_acquire);
+  if (direction == 0) {
+    impl_->tq.push(n);
+  } else {
+    impl_->head_tq.push(n);
+  }
+  // the queue was idle, start running
+  if (impl_->pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+    task_queue_impl::dispatch_next(std::shared_ptr<task_queue_impl>(impl_));
+  }
+}
+
+/**
+ * @brief Post a batch of async tasks in order, the whole batch is pushed 
+ * to the queue at once and the queue is started at most one time
+*/
+void task_queue::post_tasks(task_batch_t&& tasks, int direction) {
+  if (!impl_->valid) return;
+  auto now = (impl_->has_timestamps() ? task_now() : task_time_t());
+  auto epoch = impl_->epoch.load(std::memory_order_acquire);
+  task_queue_impl::task_node* first = nullptr;
+  task_queue_impl::task_node* last = nullptr;
+  size_t count = 0;
+  for (auto& lt : tasks) {
+    if (!lt.t) continue;
+    auto n = task_queue_impl::acquire_node();
+    n->t.t = std::move(lt.t);
+    n->t.loc = lt.loc;
+    n->t.post_time = now;
+    n->epoch = epoch;
+    if (last == nullptr) {
+      first = n;
     } else {
-      impl->running = false;
+      last->next.store(n, std::memory_order_relaxed);
     }
-  };
-
-  std::lock_guard<std::mutex> _(impl_->lock);
+    last = n;
+    ++count;
+  }
+  tasks.clear();
+  if (count == 0) return;
   if (direction == 0) {
-    impl_->tq.emplace_back(std::move(st));
+    impl_->tq.push_chain(first, last);
   } else {
-    impl_->tq.emplace_front(std::move(st));
+    impl_->head_tq.push_chain(first, last);
   }
-  // the only one in the queue is current task
-  if (impl_->tq.size() == 1 && impl_->running == false) {
-    if (auto seq = impl_->related_eq.lock()) {
-      impl_->running = true;
-      seq->emplace_back(std::move(impl_->tq.front()), (size_t)impl_->priority);
-    }
+  if (impl_->pending.fetch_add(count, std::memory_order_acq_rel) == 0) {
+    task_queue_impl::dispatch_next(std::shared_ptr<task_queue_impl>(impl_));
   }
 }
 
+/**
+ * @brief Post a task to the tail of the queue after the delay
+*/
+timer_handle task_queue::post_delayed(task_location loc, task_t t, duration_t delay) {
+  return this->post_at(loc, std::move(t), task_now() + delay);
+}
+
+/**
+ * @brief Post a task to the tail of the queue at the time, the timer keeps it till due
+*/
+timer_handle task_queue::post_at(task_location loc, task_t t, task_time_t time) {
+  if (!impl_->valid) return timer_handle{};
+  return timer::post_at(tq_wt(this->shared_from_this()), loc, std::move(t), time);
+}
+
+/**
+ * @brief Cancel a delayed task which is not due yet
+*/
+void task_queue::cancel_delayed(timer_handle h) {
+  timer::cancel_once(h);
+}
+
 /**
  * @brief Wait for current task to be done
 */
@@ -204,7 +505,7 @@ void task_queue::sync_task(task_location loc, task_t t) {
     } else {
       movable_flag mf;
       auto ss = mf.state();
-      this->post_task(loc, [t, mf]() {
+      this->post_task(loc, [t = std::move(t), mf]() {
         t();
       });
       ss->wait();
@@ -212,21 +513,79 @@ void task_queue::sync_task(task_location loc, task_t t) {
   }
 }
 
+/**
+ * @brief Change the run budget, default is 64 tasks or 200us
+*/
+void task_queue::set_run_budget(unsigned int count, std::chrono::microseconds slice) {
+  impl_->run_budget_count = (count == 0 ? 1 : count);
+  impl_->run_budget_slice = slice;
+}
+
 /**
  * @brief Change the recent trace info keep count, default is 100
 */
 void task_queue::set_recent_trace_keep_count(unsigned int count) {
   if (!impl_->valid) return;
-  std::lock_guard<std::mutex> _(impl_->lock);
-  impl_->keep_recent_count = count;
+  std::lock_guard<std::mutex> _(impl_->trace_l);
+  trace_ring* old = impl_->recent_trace.load(std::memory_order_acquire);
+  if (old->capacity() == count) {
+    return;
+  }
+  // the running task may still write to the old ring, it is only retired and
+  // freed by a later task_done. Carry over the newest items, the ones written
+  // during the copy are lost
+  std::unique_ptr<trace_ring> ring(new trace_ring(count));
+  std::queue<task_trace_item> items;
+  old->snapshot(items);
+  while (items.size() > count) {
+    items.pop();
+  }
+  for (; !items.empty(); items.pop()) {
+    ring->push(items.front());
+  }
+  impl_->recent_trace.store(ring.get(), std::memory_order_release);
+  impl_->trace_rings.push_back(std::move(ring));
+  impl_->trace_retired.store(true, std::memory_order_release);
 }
 
 /**
  * @brief Get the recent trace info list(Copied)
 */
 std::queue<task_trace_item> task_queue::recent_trace_info() const {
-  std::lock_guard<std::mutex> _(impl_->lock);
-  return impl_->recent_trace;
+  std::queue<task_trace_item> items;
+  // the lock keeps the ring from being freed, the writer never waits for it
+  std::lock_guard<std::mutex> _(impl_->trace_l);
+  impl_->recent_trace.load(std::memory_order_acquire)->snapshot(items);
+  return items;
+}
+
+/**
+ * @brief Change what the queue records for its tasks, limited to the level compiled in
+*/
+void task_queue::set_trace_level(trace_level level) {
+  int l = (int)level;
+  if (l > LIBTQ_TRACE_LEVEL) l = LIBTQ_TRACE_LEVEL;
+  if (l < 0) l = 0;
+  impl_->tracing.store(l, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the trace level in use
+*/
+trace_level task_queue::get_trace_level() const {
+  return (trace_level)impl_->tracing.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the wait and run time histograms(Copied)
+*/
+task_trace_histogram task_queue::trace_histogram() const {
+  task_trace_histogram h;
+  for (size_t i = 0; i < task_trace_histogram::k_buckets; ++i) {
+    h.wait[i] = impl_->wait_hist[i].load(std::memory_order_relaxed);
+    h.run[i] = impl_->run_hist[i].load(std::memory_order_relaxed);
+  }
+  return h;
 }
 
 } // namespace libtq
@@ -36,9 +36,12 @@ SOFTWARE.
 
 #include <list>
 #include <queue>
+#include <vector>
 #include <memory>
 
 #include "task_event_queue.h"
+#include "task_mpsc_queue.h"
+#include "task_trace_ring.h"
 #include "task_worker_group.h"
 #include "task.h"
 
@@ -55,23 +58,130 @@ namespace libtq {
 typedef std::shared_ptr<worker_group> wg_st;
 typedef std::weak_ptr<worker_group>   wg_wt;
 
+/**
+ * @brief A task with the location it is posted from, for posting in batch
+*/
+struct located_task {
+  task_location   loc;
+  task_t          t;
+};
+typedef std::vector<located_task> task_batch_t;
+
+/**
+ * @brief Handle of a pending timer job, the shard and slot of the job and
+ * the generation of the slot. Once the job fired or was cancelled the
+ * handle is stale and cancelling it does nothing.
+*/
+struct timer_handle {
+  uint32_t shard;
+  uint32_t slot;
+  uint32_t gen;
+
+  timer_handle() : shard(0), slot(0), gen(0) {}
+  timer_handle(uint32_t sh, uint32_t s, uint32_t g) : shard(sh), slot(s), gen(g) {}
+
+  explicit operator bool() const {
+    return gen != 0;
+  }
+  bool operator == (const timer_handle& rh) const {
+    return shard == rh.shard && slot == rh.slot && gen == rh.gen;
+  }
+  bool operator != (const timer_handle& rh) const {
+    return !(*this == rh);
+  }
+};
+
+class task_node_cache;
+
 /**
  * @brief Inner data storage of a task queue
 */
 struct task_queue_impl {
-  std::mutex                    lock;
-  std::list<task>               tq;
+  struct task_node : public mpsc_hook {
+    task          t;
+    uint64_t      epoch;
+    task_node*    free_next;    // link in the node cache
+    task_node_cache* cache;   // the cache the node goes back to
+  };
+  mpsc_queue<task_node>         tq;
+  mpsc_queue<task_node>         head_tq;    // posted to the head, taken before tq
+  std::atomic<size_t>           pending;    // posted but not done, running when > 0
+  std::atomic<uint64_t>         epoch;      // changed by cancel, older tasks are dropped
   std::atomic_bool              valid;
-  std::atomic_bool              running;
   eq_wt                         related_eq;
   wg_wt                         related_wg;
   thread_priority               priority;
-  unsigned int                  keep_recent_count;  // default = 100;
-  std::queue<task_trace_item>   recent_trace;
+  // recent trace info written by the task_done of the running task, readers
+  // take a snapshot; a resize retires the ring, freed by the next task_done
+  std::atomic<trace_ring*>      recent_trace;
+  std::mutex                    trace_l;    // for the resize and the readers
+  std::vector<std::unique_ptr<trace_ring>> trace_rings;   // the last one is in use
+  std::atomic_bool              trace_retired;
+  std::atomic<int>              tracing;    // trace_level, default = k_timestamps
+  // written like the ring, by the task_done of the running task
+  std::atomic<uint64_t>         wait_hist[task_trace_histogram::k_buckets];
+  std::atomic<uint64_t>         run_hist[task_trace_histogram::k_buckets];
+  // tasks a worker can run in a row before giving the worker back
+  std::atomic<unsigned int>     run_budget_count;   // default = 64
+  std::atomic<std::chrono::microseconds> run_budget_slice;  // default = 200us
 
   task_queue_impl() = default;
+  ~task_queue_impl();
   task_queue_impl(const task_queue_impl&) = delete;
   task_queue_impl& operator = (const task_queue_impl&) = delete;
+
+  /**
+   * @brief Get a node from the calling thread's node cache
+  */
+  static task_node* acquire_node();
+
+  /**
+   * @brief Destroy the task and give the node back to its cache, any thread
+  */
+  static void release_node(task_node* n);
+
+  /**
+   * @brief Take the next task and hand it to the event queue.
+   * Only the thread which changes pending from 0, or finishes a task while
+   * pending is still more than 1 can call it, so there is one consumer at a time.
+  */
+  static void dispatch_next(std::shared_ptr<task_queue_impl>&& impl);
+
+  /**
+   * @brief Take the next task which is not cancelled into t, consumer only.
+   * @return false if nothing left, pending has gone back to 0
+  */
+  static bool take_next(std::shared_ptr<task_queue_impl>&& impl, task& t);
+
+  /**
+   * @brief Check if the tasks take the post, begin and end time, any thread
+  */
+  bool has_timestamps() const {
+#if LIBTQ_TRACE_LEVEL >= 2
+    return tracing.load(std::memory_order_relaxed) >= (int)trace_level::k_timestamps;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Called by the worker after a task of the queue is done, record the trace.
+   * If keep_running, the next task is moved into t for the worker to run in place,
+   * otherwise the next task is handed to the event queue.
+   * @return true if t is the next task to run
+  */
+  static bool task_done(task& t, bool keep_running);
+
+  /**
+   * @brief Record the trace of a done task by the trace level, writer only
+  */
+  void record_trace_(const task& t);
+
+  /**
+   * @brief Free the retired trace rings, writer only. The previous task is done
+   * and this one has not loaded the ring yet, so no writer is using them
+  */
+  void reclaim_trace_rings_();
 };
 
 class task_queue : public std::enable_shared_from_this<task_queue> {
@@ -104,11 +214,44 @@ public:
   */
   void post_task(task_location loc, task_t t, int direction = 0);
 
+  /**
+   * @brief Post a batch of async tasks in order, the whole batch is pushed 
+   * to the queue at once and the queue is started at most one time
+   * @param direction: 0: post to the tail of queue, 1: post to the head of the queue
+  */
+  void post_tasks(task_batch_t&& tasks, int direction = 0);
+
+  /**
+   * @brief Post a task to the tail of the queue after the delay. Delayed tasks
+   * of a queue come due in deadline order, the ones with the same deadline in
+   * posting order. Not affected by cancel, use cancel_delayed.
+   * @return handle to cancel the task before it is due, empty if the task is empty
+  */
+  timer_handle post_delayed(task_location loc, task_t t, duration_t delay);
+
+  /**
+   * @brief Post a task to the tail of the queue at the time, see post_delayed
+  */
+  timer_handle post_at(task_location loc, task_t t, task_time_t time);
+
+  /**
+   * @brief Cancel a delayed task which is not due yet, the task is destroied
+   * right away. Stale handles are ignored.
+  */
+  void cancel_delayed(timer_handle h);
+
   /**
    * @brief Wait for current task to be done
   */
   void sync_task(task_location loc, task_t t);
   
+  /**
+   * @brief Change the run budget. A worker keeps running the tasks of this queue
+   * till count tasks are done or the slice is used up, then hands the next task
+   * back to the event queue. Default is 64 tasks or 200us, 1 for no budget.
+  */
+  void set_run_budget(unsigned int count, std::chrono::microseconds slice);
+
   /**
    * @brief Change the recent trace info keep count, default is 100
   */
@@ -119,6 +262,22 @@ public:
   */
   std::queue<task_trace_item> recent_trace_info() const;
 
+  /**
+   * @brief Change what the queue records for its tasks from now on, default is
+   * k_timestamps, limited to the level compiled in, see LIBTQ_TRACE_LEVEL
+  */
+  void set_trace_level(trace_level level);
+
+  /**
+   * @brief Get the trace level in use
+  */
+  trace_level get_trace_level() const;
+
+  /**
+   * @brief Get the wait and run time histograms(Copied), recorded at k_histogram
+  */
+  task_trace_histogram trace_histogram() const;
+
 public:
   task_queue(const task_queue&) = delete;
   task_queue(task_queue&&) = delete;
@@ -151,13 +151,13 @@ private:
 };
 
 template <typename T>
-std::function<void()> weak_protector_wrapper(
+libtq::task_t weak_protector_wrapper(
     weak_protector<T> wp,
-    std::function<void()> job,
+    libtq::task_t job,
     std::function<void()> lock_failed = nullptr
 ) {
   if (!job) return nullptr;
-  return [wp, job, lock_failed]() {
+  return [wp, job = std::move(job), lock_failed]() {
     if (auto sp = wp.lock()) {
       job();
     } else {
@@ -169,14 +169,14 @@ std::function<void()> weak_protector_wrapper(
 }
 
 template <typename T>
-std::function<void()> protector_wrapper(
+libtq::task_t protector_wrapper(
     rawptr_protector<T>* rp, 
-    std::function<void()> job, 
+    libtq::task_t job, 
     std::function<void()> lock_failed = nullptr
 ) {
   if (rp == nullptr || !job) return nullptr;
   auto w_rp = rp->protector();
-  return weak_protector_wrapper(w_rp, job, lock_failed);
+  return weak_protector_wrapper(w_rp, std::move(job), lock_failed);
 }
 
 template<typename T>
@@ -192,14 +192,14 @@ public:
 
   task_helper& operator << (libtq::task_t task) {
     if (auto sq = wq_.lock()) {
-      sq->post_task(loc_, weak_protector_wrapper(wptr_, task));
+      sq->post_task(loc_, weak_protector_wrapper(wptr_, std::move(task)));
     }
     return *this;
   }
 
   task_helper& operator () (libtq::task_t task, std::function<void()> lock_failed) {
     if (auto sq = wq_.lock()) {
-      sq->post_task(loc_, weak_protector_wrapper(wptr_, task, lock_failed));
+      sq->post_task(loc_, weak_protector_wrapper(wptr_, std::move(task), lock_failed));
     } else {
       if (lock_failed) {
         lock_failed();
@@ -210,14 +210,14 @@ public:
 
   task_helper& operator <<= (libtq::task_t task) {
     if (auto sq = wq_.lock()) {
-      sq->post_task(loc_, task);
+      sq->post_task(loc_, std::move(task));
     }
     return *this;
   }
 
   task_helper& operator >> (libtq::task_t task) {
     if (auto sq = wq_.lock()) {
-      sq->sync_task(loc_, weak_protector_wrapper(wptr_, task));
+      sq->sync_task(loc_, weak_protector_wrapper(wptr_, std::move(task)));
     }
     return *this;
   }
@@ -31,8 +31,14 @@ SOFTWARE.
 
 #include <queue>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <limits>
+#include <mutex>
+#include <tuple>
 #ifdef _WIN32
 #include <Windows.h>
 #include <timeapi.h>
@@ -40,9 +46,19 @@ SOFTWARE.
 #pragma comment(lib, "Winmm.lib")
 #pragma comment(lib, "ntdll.lib")
 #endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
 #include "task_timer.h"
+#include "task_clock.h"
 #include "task.h"
 #include "task_event_queue.h"
+#include "task_mpsc_queue.h"
 #include "task_thread.h"
 
 #ifdef _WIN32
@@ -76,140 +92,1148 @@ void adjust_timer_resolution_default() {
 #define LIBTQ_PICKUP_EST_TIME   12u
 #endif
 
-typedef std::function<void(task_time_t)> timer_job_t;
+/**
+ * @brief Build with LIBTQ_TIMER_USE_WHEEL=1 to start with the timing wheel
+ * engine instead of the heap, the tick is LIBTQ_TIMER_WHEEL_TICK_US.
+*/
+#ifndef LIBTQ_TIMER_USE_WHEEL
+#define LIBTQ_TIMER_USE_WHEEL     0
+#endif
+#ifndef LIBTQ_TIMER_WHEEL_TICK_US
+#define LIBTQ_TIMER_WHEEL_TICK_US 1000
+#endif
+
+/**
+ * @brief On Linux the timer thread sleeps on a timerfd armed to the earliest
+ * deadline and an eventfd for changes, in one epoll_wait.
+ * Build with LIBTQ_TIMER_USE_TIMERFD=0 to start with the condition variable.
+*/
+#if defined(__linux__)
+#define LIBTQ_TIMER_HAS_TIMERFD   1
+#else
+#define LIBTQ_TIMER_HAS_TIMERFD   0
+#endif
+#ifndef LIBTQ_TIMER_USE_TIMERFD
+#define LIBTQ_TIMER_USE_TIMERFD   LIBTQ_TIMER_HAS_TIMERFD
+#endif
+
+/**
+ * @brief On Linux the timer thread spins instead of sleeping when the next
+ * deadline is closer than this, in microseconds, see timer::set_spin_threshold.
+ * Off by default, a spinning timer thread keeps a core busy.
+*/
+#ifndef LIBTQ_TIMER_SPIN_US
+#define LIBTQ_TIMER_SPIN_US       0
+#endif
+
+/**
+ * @brief Count of the timer shards at start, see timer::set_shards
+*/
+#ifndef LIBTQ_TIMER_SHARDS
+#define LIBTQ_TIMER_SHARDS        1
+#endif
+
+struct timer_node;
 
-template <typename T, typename M>
-class removable_priority_queue : public std::priority_queue<T, std::vector<T>, std::greater<T>> {
+/**
+ * @brief Link of a node in the inbox of a timer worker, a node has one to
+ * arm it and one to cancel it
+*/
+struct timer_inbox_link : mpsc_hook {
+  timer_node*   node;
+};
+
+/**
+ * @brief A timer job, lives in the slot table of its worker and linked into
+ * one of the timer engines when pending
+*/
+struct timer_node {
+  task_time_t   fire_time;
+  task_location loc;
+  // the queue to post the job to when fired
+  tq_wt         queue;
+  // job of a one shot timer, moved out to fire
+  task_t        job;
+  // job of a periodic timer, shared by the posted tasks
+  std::shared_ptr<task_t> periodic_job;
+  // post to the tail (0) or the head (1) of the queue
+  int           direction;
+  // arm order in the worker, orders the jobs with the same fire time
+  uint64_t      seq;
+  // zero for a one shot job, or the period of a periodic job
+  duration_t    interval;
+  // the job can fire any time in [fire_time, fire_time + leeway]
+  duration_t    leeway;
+  // idle after each fire until armed again, the job is in periodic_job
+  bool          rearmable = false;
+
+  task_time_t latest() const {
+    return fire_time + leeway;
+  }
+
+  // generation of the slot in the high 32 bits and the state in the low bits,
+  // the only field written by both the timer thread and the other threads
+  std::atomic<uint64_t> ctrl{0};
+  // index in the slot table
+  uint32_t      slot = 0;
+  // next slot in the free list
+  std::atomic<uint32_t> free_next{0};
+  // where the node is, only used by the timer thread
+  uint8_t       place = 0;
+
+  timer_inbox_link  arm_link;
+  timer_inbox_link  cancel_link;
+
+  // position in the heap engine
+  size_t        heap_index;
+
+  // position in the wheel engine
+  uint64_t      expire_tick;
+  timer_node*   prev;
+  timer_node*   next;
+  uint16_t      wheel_level;
+  uint16_t      wheel_slot;
+};
+
+/**
+ * @brief Storage of the pending timer nodes, ordered by fire time.
+ * Only accessed by the timer thread.
+*/
+class timer_engine {
 public:
-  bool erase(M m) {
-    auto it = std::find_if(this->c.begin(), this->c.end(), [m](const T& item) {
-      return item.match(m);
-    });
-    if (it == this->c.end()) {
-      return false;
+  virtual ~timer_engine() {}
+
+  virtual void insert(timer_node* n) = 0;
+  virtual void erase(timer_node* n) = 0;
+  /**
+   * @brief Earliest time the engine needs to be polled again,
+   * task_time_t::max() when empty
+  */
+  virtual task_time_t next_deadline() = 0;
+  /**
+   * @brief Take one node which is due at `now`, nullptr if nothing is due
+  */
+  virtual timer_node* pop_due(task_time_t now) = 0;
+  /**
+   * @brief Take all the nodes out, used when switching engines
+  */
+  virtual void take_all(std::vector<timer_node*>& nodes) = 0;
+  virtual size_t size() const = 0;
+};
+
+/**
+ * @brief Binary min-heap which remembers each node's index,
+ * insert and erase are both O(log n). Ordered by the latest fire time,
+ * when the top one is due, all the following ones whose window has
+ * started are fired in the same wake up.
+*/
+class timer_heap_engine : public timer_engine {
+public:
+  void insert(timer_node* n) override {
+    n->heap_index = heap_.size();
+    heap_.push_back(n);
+    this->sift_up_(n->heap_index);
+  }
+  void erase(timer_node* n) override {
+    size_t i = n->heap_index;
+    timer_node* last = heap_.back();
+    heap_.pop_back();
+    if (last == n) {
+      return;
     }
-    if (it == this->c.begin()) {
-      this->pop();
+    heap_[i] = last;
+    last->heap_index = i;
+    if (i > 0 && last->latest() < heap_[(i - 1) / 2]->latest()) {
+      this->sift_up_(i);
     } else {
-      this->c.erase(it);
-      std::make_heap(this->c.begin(), this->c.end(), this->comp);
+      this->sift_down_(i);
     }
-    return true;
   }
+  task_time_t next_deadline() override {
+    return heap_.empty() ? task_time_t::max() : heap_.front()->latest();
+  }
+  timer_node* pop_due(task_time_t now) override {
+    if (heap_.empty() || heap_.front()->fire_time > now) {
+      return nullptr;
+    }
+    timer_node* n = heap_.front();
+    this->erase(n);
+    return n;
+  }
+  void take_all(std::vector<timer_node*>& nodes) override {
+    nodes.insert(nodes.end(), heap_.begin(), heap_.end());
+    heap_.clear();
+  }
+  size_t size() const override {
+    return heap_.size();
+  }
+
+protected:
+  void sift_up_(size_t i) {
+    timer_node* n = heap_[i];
+    while (i > 0) {
+      size_t p = (i - 1) / 2;
+      if (!(n->latest() < heap_[p]->latest())) break;
+      heap_[i] = heap_[p];
+      heap_[i]->heap_index = i;
+      i = p;
+    }
+    heap_[i] = n;
+    n->heap_index = i;
+  }
+  void sift_down_(size_t i) {
+    timer_node* n = heap_[i];
+    size_t count = heap_.size();
+    while (true) {
+      size_t c = i * 2 + 1;
+      if (c >= count) break;
+      if (c + 1 < count && heap_[c + 1]->latest() < heap_[c]->latest()) ++c;
+      if (!(heap_[c]->latest() < n->latest())) break;
+      heap_[i] = heap_[c];
+      heap_[i]->heap_index = i;
+      i = c;
+    }
+    heap_[i] = n;
+    n->heap_index = i;
+  }
+
+protected:
+  std::vector<timer_node*> heap_;
 };
 
-struct priority_job {
-  uint64_t      job_id;
-  task_time_t   fire_time;
-  timer_job_t   job;
-  task_location loc;
+/**
+ * @brief Hierarchical timing wheel, insert and erase are O(1).
+ * Level 0 has 256 slots of one tick, each upper level has 64 slots
+ * and every slot covers a whole round of the level below. Nodes in
+ * an upper level are cascaded down when the wheel reaches their slot.
+ * A node fires on the first tick not earlier than its fire time, so
+ * the resolution is one tick. With a leeway the node is put on the
+ * roundest tick in its window, so the nodes with overlapping windows
+ * share the same slot.
+*/
+class timer_wheel_engine : public timer_engine {
+  enum {
+    k_l0_bits   = 8,
+    k_ln_bits   = 6,
+    k_l0_size   = 1 << k_l0_bits,
+    k_ln_size   = 1 << k_ln_bits,
+    k_levels    = 5,
+    k_due_level = k_levels
+  };
+  struct slot_list {
+    timer_node* head;
+    timer_node* tail;
+  };
+
+public:
+  explicit timer_wheel_engine(duration_t tick) :
+    tick_(tick < std::chrono::microseconds(1) ? duration_t(std::chrono::microseconds(1)) : tick),
+    origin_(task_now()), cur_(0), size_(0), l0_(), ln_(), due_(), l0_bits_(), ln_bits_()
+  {}
+
+  void insert(timer_node* n) override {
+    n->expire_tick = this->tick_of_(n->fire_time);
+    if (n->leeway > duration_t::zero()) {
+      auto lt = n->latest();
+      uint64_t last = (lt <= origin_) ? 0 : (uint64_t)((lt - origin_) / tick_);
+      if (last > n->expire_tick) {
+        // clear the low bits below the highest bit differs between (first - 1) and last
+        uint64_t keep = ~(((uint64_t)1 << highest_bit((n->expire_tick - 1) ^ last)) - 1);
+        n->expire_tick = last & keep;
+      }
+    }
+    this->place_(n);
+    ++size_;
+  }
+  void erase(timer_node* n) override {
+    this->unlink_(n);
+    --size_;
+  }
+  task_time_t next_deadline() override {
+    if (due_.head != nullptr) {
+      return origin_ + tick_ * (int64_t)cur_;
+    }
+    uint64_t t = this->next_event_tick_();
+    return (t == UINT64_MAX) ? task_time_t::max() : origin_ + tick_ * (int64_t)t;
+  }
+  timer_node* pop_due(task_time_t now) override {
+    if (due_.head == nullptr) {
+      if (now < origin_) return nullptr;
+      this->advance_((uint64_t)((now - origin_) / tick_));
+      if (due_.head == nullptr) return nullptr;
+    }
+    timer_node* n = due_.head;
+    this->erase(n);
+    return n;
+  }
+  void take_all(std::vector<timer_node*>& nodes) override {
+    auto drain = [&nodes](slot_list& sl) {
+      for (timer_node* n = sl.head; n != nullptr; n = n->next) {
+        nodes.push_back(n);
+      }
+      sl.head = sl.tail = nullptr;
+    };
+    for (auto& sl : l0_) drain(sl);
+    for (auto& lv : ln_) for (auto& sl : lv) drain(sl);
+    drain(due_);
+    std::fill(std::begin(l0_bits_), std::end(l0_bits_), 0);
+    std::fill(std::begin(ln_bits_), std::end(ln_bits_), 0);
+    size_ = 0;
+  }
+  size_t size() const override {
+    return size_;
+  }
+
+protected:
+  static uint64_t slot_width_(size_t level) {
+    return (level == 0) ? 1 : ((uint64_t)1 << (k_l0_bits + k_ln_bits * (level - 1)));
+  }
+
+  /**
+   * @brief Round up, never fire earlier than the given time
+  */
+  uint64_t tick_of_(task_time_t t) const {
+    if (t <= origin_) return 0;
+    auto d = t - origin_;
+    uint64_t ticks = (uint64_t)(d / tick_);
+    return (d % tick_ == duration_t::zero()) ? ticks : ticks + 1;
+  }
+
+  slot_list& slot_(uint16_t level, uint16_t slot) {
+    if (level == k_due_level) return due_;
+    return (level == 0) ? l0_[slot] : ln_[level - 1][slot];
+  }
+
+  void place_(timer_node* n) {
+    uint64_t e = n->expire_tick;
+    if (e <= cur_) {
+      this->link_(n, k_due_level, 0);
+      return;
+    }
+    uint64_t delta = e - cur_;
+    if (delta < k_l0_size) {
+      this->link_(n, 0, (uint16_t)(e & (k_l0_size - 1)));
+      return;
+    }
+    for (uint16_t level = 1; level < k_levels; ++level) {
+      uint64_t w = slot_width_(level);
+      bool top = (level == k_levels - 1);
+      if (delta < w * k_ln_size || top) {
+        // Too far away, park in the farthest top slot, re-placed when cascaded
+        uint64_t pe = (delta < w * k_ln_size) ? e : cur_ + w * k_ln_size - 1;
+        this->link_(n, level, (uint16_t)((pe / w) & (k_ln_size - 1)));
+        return;
+      }
+    }
+  }
+
+  void link_(timer_node* n, uint16_t level, uint16_t slot) {
+    n->wheel_level = level;
+    n->wheel_slot = slot;
+    slot_list& sl = this->slot_(level, slot);
+    n->next = nullptr;
+    n->prev = sl.tail;
+    if (sl.tail != nullptr) sl.tail->next = n;
+    else sl.head = n;
+    sl.tail = n;
+    if (level == 0) {
+      l0_bits_[slot / 64] |= ((uint64_t)1 << (slot % 64));
+    } else if (level != k_due_level) {
+      ln_bits_[level - 1] |= ((uint64_t)1 << slot);
+    }
+  }
+
+  void unlink_(timer_node* n) {
+    slot_list& sl = this->slot_(n->wheel_level, n->wheel_slot);
+    if (n->prev != nullptr) n->prev->next = n->next;
+    else sl.head = n->next;
+    if (n->next != nullptr) n->next->prev = n->prev;
+    else sl.tail = n->prev;
+    n->prev = n->next = nullptr;
+    if (sl.head == nullptr) {
+      this->clear_bit_(n->wheel_level, n->wheel_slot);
+    }
+  }
+
+  void clear_bit_(uint16_t level, uint16_t slot) {
+    if (level == 0) {
+      l0_bits_[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    } else if (level != k_due_level) {
+      ln_bits_[level - 1] &= ~((uint64_t)1 << slot);
+    }
+  }
+
+  /**
+   * @brief Distance from `start` to the first set bit, scanning circularly,
+   * UINT64_MAX if no bit is set
+  */
+  static uint64_t scan_(const uint64_t* words, size_t nwords, size_t start) {
+    size_t nbits = nwords * 64;
+    for (size_t off = 0; off < nbits; ) {
+      size_t pos = (start + off) % nbits;
+      uint64_t m = words[pos / 64] >> (pos % 64);
+      if (m != 0) return off + lowest_bit(m);
+      off += 64 - (pos % 64);
+    }
+    return UINT64_MAX;
+  }
 
-  bool operator > (const priority_job& rh) const {
-    return fire_time > rh.fire_time;
+  /**
+   * @brief The next tick something happens, either a level 0 slot
+   * fires or an upper slot cascades
+  */
+  uint64_t next_event_tick_() const {
+    uint64_t best = UINT64_MAX;
+    uint64_t k = scan_(l0_bits_, k_l0_size / 64, (size_t)((cur_ + 1) & (k_l0_size - 1)));
+    if (k != UINT64_MAX) {
+      best = cur_ + 1 + k;
+    }
+    for (size_t level = 1; level < k_levels; ++level) {
+      if (ln_bits_[level - 1] == 0) continue;
+      uint64_t w = slot_width_(level);
+      uint64_t c = cur_ / w;
+      k = scan_(&ln_bits_[level - 1], 1, (size_t)((c + 1) & (k_ln_size - 1)));
+      uint64_t t = (c + 1 + k) * w;
+      if (t < best) best = t;
+    }
+    return best;
   }
-  bool match(uint64_t jid) const {
-    return this->job_id == jid;
+
+  /**
+   * @brief Move the wheel to `target`, jumping over the idle ticks
+  */
+  void advance_(uint64_t target) {
+    while (cur_ < target) {
+      uint64_t nt = this->next_event_tick_();
+      if (nt > target) {
+        cur_ = target;
+        break;
+      }
+      cur_ = nt;
+      for (size_t level = k_levels - 1; level > 0; --level) {
+        uint64_t w = slot_width_(level);
+        if (cur_ % w != 0) continue;
+        uint16_t slot = (uint16_t)((cur_ / w) & (k_ln_size - 1));
+        slot_list sl = ln_[level - 1][slot];
+        if (sl.head == nullptr) continue;
+        ln_[level - 1][slot] = slot_list{nullptr, nullptr};
+        this->clear_bit_((uint16_t)level, slot);
+        for (timer_node* n = sl.head; n != nullptr; ) {
+          timer_node* next = n->next;
+          this->place_(n);
+          n = next;
+        }
+      }
+      uint16_t slot = (uint16_t)(cur_ & (k_l0_size - 1));
+      slot_list& sl = l0_[slot];
+      if (sl.head != nullptr) {
+        for (timer_node* n = sl.head; n != nullptr; n = n->next) {
+          n->wheel_level = k_due_level;
+          n->wheel_slot = 0;
+        }
+        if (due_.tail != nullptr) {
+          due_.tail->next = sl.head;
+          sl.head->prev = due_.tail;
+        } else {
+          due_.head = sl.head;
+        }
+        due_.tail = sl.tail;
+        sl.head = sl.tail = nullptr;
+        this->clear_bit_(0, slot);
+      }
+    }
   }
+
+protected:
+  duration_t    tick_;
+  task_time_t   origin_;
+  uint64_t      cur_;
+  size_t        size_;
+  slot_list     l0_[k_l0_size];
+  slot_list     ln_[k_levels - 1][k_ln_size];
+  slot_list     due_;
+  uint64_t      l0_bits_[k_l0_size / 64];
+  uint64_t      ln_bits_[k_levels - 1];
 };
 
+inline std::unique_ptr<timer_engine> make_timer_engine(timer_engine_type type, duration_t tick) {
+  if (type == timer_engine_type::k_wheel) {
+    return std::unique_ptr<timer_engine>(new timer_wheel_engine(tick));
+  }
+  return std::unique_ptr<timer_engine>(new timer_heap_engine());
+}
+
 class timer_inner_worker : public thread {
+  friend class timer_shards;
 public:
-  static timer_inner_worker& instance() {
-    static timer_inner_worker g_tiw;
-    return g_tiw;
-  }
   /**
    * @brief Force to stop the loop
   */
   ~timer_inner_worker() {
-    // std::lock_guard<std::mutex> _(cv_l_);
     this->invalidate_();
-    cv_.notify_all();
+    this->wake_up_();
+    // the nodes are used by the thread until it leaves the loop
+    while (running_.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+#if LIBTQ_TIMER_HAS_TIMERFD
+    this->close_timerfd_();
+#endif
+    // jobs left in the engine or the inbox are destroied with their nodes
+    size_t count = chunk_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+      delete [] chunks_[i].load(std::memory_order_relaxed);
+    }
   }
   timer_inner_worker(const timer_inner_worker&) = delete;
   timer_inner_worker& operator = (const timer_inner_worker&) = delete;
 
   /**
-   * @brief Add a job to the timer poll, will re-order the pending list
+   * @brief Add a one shot job to the timer poll from any thread, without lock.
+   * The job is put in the inbox, and the timer thread is woken up only when
+   * the job is due before the time it is sleeping to.
+  */
+  timer_handle add_next_job(task_time_t t, task_location loc, tq_wt queue, task_t job,
+    duration_t leeway, int direction = 1
+  ) {
+    timer_node* n = this->alloc_node_();
+    if (n == nullptr) {
+      return timer_handle{};
+    }
+    n->job = std::move(job);
+    n->direction = direction;
+    return this->arm_(n, t, loc, std::move(queue), duration_t::zero(), leeway);
+  }
+
+  /**
+   * @brief Add a periodic job, it keeps its slot and is re-armed after each
+   * fire until removed
+  */
+  timer_handle add_periodic_job(task_time_t t, task_location loc, tq_wt queue,
+    std::shared_ptr<task_t> job, duration_t interval, duration_t leeway
+  ) {
+    timer_node* n = this->alloc_node_();
+    if (n == nullptr) {
+      return timer_handle{};
+    }
+    n->periodic_job = std::move(job);
+    n->direction = 1;
+    return this->arm_(n, t, loc, std::move(queue), interval, leeway);
+  }
+
+  /**
+   * @brief Add a re-armable job, idle until rearm_job. After each fire it keeps
+   * its slot and goes back to idle, so one handle serves many deadlines
+  */
+  timer_handle add_idle_job(task_location loc, tq_wt queue, std::shared_ptr<task_t> job, int direction) {
+    timer_node* n = this->alloc_node_();
+    if (n == nullptr) {
+      return timer_handle{};
+    }
+    n->periodic_job = std::move(job);
+    n->direction = direction;
+    n->loc = loc;
+    n->queue = std::move(queue);
+    n->interval = duration_t::zero();
+    n->leeway = duration_t::zero();
+    n->rearmable = true;
+    uint32_t gen = (uint32_t)(n->ctrl.load(std::memory_order_relaxed) >> 32);
+    n->ctrl.store(make_ctrl_(gen, k_idle), std::memory_order_release);
+    return timer_handle{index_, n->slot, gen};
+  }
+
+  /**
+   * @brief Arm an idle job to fire at t, without lock. The owner of the handle
+   * must not re-arm and remove it at the same time.
+   * @return false if the job is armed already or has been removed
+  */
+  bool rearm_job(timer_handle h, task_time_t t) {
+    if (h.shard != index_) {
+      return false;
+    }
+    timer_node* n = this->node_at_(h.slot);
+    if (n == nullptr) {
+      return false;
+    }
+    // only the owner moves an idle node, the timer thread does not touch it
+    if (n->ctrl.load(std::memory_order_acquire) != make_ctrl_(h.gen, k_idle)) {
+      return false;
+    }
+    n->fire_time = t;
+    n->ctrl.store(make_ctrl_(h.gen, k_armed), std::memory_order_release);
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    this->post_inbox_(&n->arm_link, to_ns_(t));
+    return true;
+  }
+
+  /**
+   * @brief Remove an unfired job from any thread, without lock. The handle of
+   * a fired or removed job is stale and ignored. The job is destroied right
+   * away, the node is taken out of the engine when the timer thread drains
+   * the inbox. A periodic job being fired right now is not re-armed.
+  */
+  void remove_unfired_job(timer_handle h) {
+    if (h.shard != index_) {
+      return;
+    }
+    timer_node* n = this->node_at_(h.slot);
+    if (n == nullptr) {
+      return;
+    }
+    uint64_t c = n->ctrl.load(std::memory_order_acquire);
+    bool counted = true;
+    while (true) {
+      if ((uint32_t)(c >> 32) != h.gen) {
+        return;
+      }
+      uint32_t state = (uint32_t)(c & 0xFFu);
+      if (state == k_armed || state == k_idle) {
+        if (n->ctrl.compare_exchange_weak(c, make_ctrl_(h.gen, k_cancelled), std::memory_order_acq_rel)) {
+          // the timer thread never fires a cancelled job, destroy it here
+          release_job_(n);
+          counted = (state == k_armed);
+          break;
+        }
+      } else if (state == k_firing && (n->interval != duration_t::zero() || n->rearmable)) {
+        // the timer thread destroies it after the fire
+        if (n->ctrl.compare_exchange_weak(c, make_ctrl_(h.gen, k_cancelled), std::memory_order_acq_rel)) {
+          // a re-armable job is not pending once it fires
+          counted = !n->rearmable;
+          break;
+        }
+      } else {
+        // fired, or removed already
+        return;
+      }
+    }
+    if (counted) {
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    this->post_inbox_(&n->cancel_link, k_awake);
+  }
+
+  /**
+   * @brief Count of the jobs not fired or removed yet, a periodic job counts
+   * until it is removed
+  */
+  size_t pending_count() {
+    return pending_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Switch the engine, the timer thread moves all pending jobs to the new one
+  */
+  void set_engine(timer_engine_type type, duration_t tick) {
+    {
+      std::lock_guard<std::mutex> _(engine_l_);
+      next_engine_ = make_timer_engine(type, tick);
+      engine_changed_.store(true, std::memory_order_release);
+    }
+    this->wake_up_();
+  }
+
+  /**
+   * @brief Select how the timer thread sleeps, false if not supported
+  */
+  bool set_backend(timer_backend backend) {
+#if LIBTQ_TIMER_HAS_TIMERFD
+    if (backend == timer_backend::k_timerfd && epfd_ < 0) {
+      return false;
+    }
+#else
+    if (backend == timer_backend::k_timerfd) {
+      return false;
+    }
+#endif
+    backend_ = backend;
+    this->wake_up_();
+    return true;
+  }
+
+  void set_spin_threshold(duration_t threshold) {
+    spin_threshold_ = (threshold > duration_t::zero() ? threshold : duration_t::zero());
+    this->wake_up_();
+  }
+
+  /**
+   * @brief Wait until the timer thread has fired every job due by t on the
+   * library clock
+  */
+  void sync_to(task_time_t t) {
+    int64_t ns = to_ns_(t);
+    this->wake_up_();
+    while (passed_ns_.load(std::memory_order_acquire) < ns && running_.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+protected:
+  /**
+   * @brief States of a node, kept in the low bits of ctrl
+  */
+  enum : uint32_t {
+    k_free        = 0,
+    k_armed       = 1,
+    k_firing      = 2,
+    k_cancelled   = 3,
+    // a re-armable job waiting to be armed again
+    k_idle        = 4
+  };
+
+  /**
+   * @brief Where a node is, only tracked by the timer thread
+  */
+  enum : uint8_t {
+    k_outside     = 0,
+    k_in_engine   = 1,
+    // popped from the engine, waits for its cancel link to be freed
+    k_detached    = 2
+  };
+
+  enum : uint32_t {
+    k_chunk_bits  = 10,
+    k_chunk_size  = 1u << k_chunk_bits,
+    k_max_chunks  = 1u << 14,
+    k_no_slot     = 0xFFFFFFFFu,
+    // wake up the timer thread to drain a long inbox even no job is due earlier
+    k_inbox_wake_backlog = 4096
+  };
+
+  /**
+   * @brief sleep_until_ when the timer thread is awake, it drains the inbox
+   * before going to sleep, no one needs to wake it up
+  */
+  static constexpr int64_t k_awake = std::numeric_limits<int64_t>::min();
+
+  /**
+   * @brief start the inner waiting loop
+  */
+  timer_inner_worker(uint32_t index, const char* name, timer_engine_type type, duration_t tick,
+    timer_backend backend, duration_t spin_threshold
+  ) : 
+    thread(make_thread_attribute(k_thread_attribute_default_stack_size, nullptr, thread_priority::k_realtime, name)),
+    wake_flag_(false),
+    index_(index),
+    engine_(make_timer_engine(type, tick)),
+    engine_changed_(false),
+    chunk_count_(0),
+    free_head_(k_no_slot),
+    pending_(0),
+    inbox_size_(0),
+    sleep_until_(k_awake),
+    passed_ns_(k_awake),
+    running_(false),
+    arm_seq_(0),
+#if LIBTQ_TIMER_HAS_TIMERFD
+    epfd_(-1), tfd_(-1), efd_(-1),
+#endif
+    backend_(backend),
+    spin_threshold_(spin_threshold)
+  {
+    for (auto& c : chunks_) {
+      c.store(nullptr, std::memory_order_relaxed);
+    }
+#if LIBTQ_TIMER_HAS_TIMERFD
+    this->open_timerfd_();
+#endif
+    if (backend_ == timer_backend::k_timerfd && !LIBTQ_TIMER_HAS_TIMERFD) {
+      backend_ = timer_backend::k_condition_variable;
+    }
+    this->start();
+    // the loop runs until the worker is invalidated in the destructor
+    running_.store(this->is_validate(), std::memory_order_release);
+  }
+
+  static uint64_t make_ctrl_(uint32_t gen, uint32_t state) {
+    return ((uint64_t)gen << 32) | state;
+  }
+
+  static int64_t to_ns_(task_time_t t) {
+    return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+  }
+
+  /**
+   * @brief Fill the node and put it in the inbox
+  */
+  timer_handle arm_(timer_node* n, task_time_t t, task_location loc, tq_wt queue,
+    duration_t interval, duration_t leeway
+  ) {
+    n->fire_time = t;
+    n->loc = loc;
+    n->queue = std::move(queue);
+    n->interval = interval;
+    n->leeway = (leeway > duration_t::zero() ? leeway : duration_t::zero());
+    uint32_t gen = (uint32_t)(n->ctrl.load(std::memory_order_relaxed) >> 32);
+    n->ctrl.store(make_ctrl_(gen, k_armed), std::memory_order_release);
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    int64_t latest = to_ns_(n->latest());
+    this->post_inbox_(&n->arm_link, latest);
+    return timer_handle{index_, n->slot, gen};
+  }
+
+  /**
+   * @brief Wake up the sleeping timer thread
   */
-  uint64_t add_next_job(task_time_t t, task_location loc, timer_job_t job) {
-    static uint64_t s_timer_job_id = 0;
-    priority_job pj{};
-    uint64_t jid = s_timer_job_id++;
-    pj.job_id = jid;
-    pj.fire_time = t;
-    pj.job = job;
-    pj.loc = loc;
+  void wake_up_() {
+#if LIBTQ_TIMER_HAS_TIMERFD
+    if (efd_ >= 0) {
+      uint64_t one = 1;
+      ssize_t r = ::write(efd_, &one, sizeof(one));
+      (void)r;
+    }
+#endif
     std::lock_guard<std::mutex> _(cv_l_);
-    pq_.emplace(std::move(pj));
-    cv_.notify_all();
-    return jid;
+    wake_flag_ = true;
+    cv_.notify_one();
+  }
+
+  /**
+   * @brief Any thread, push an arm or a cancel to the inbox, and wake up the
+   * timer thread if the job is due before the time it sleeps to
+  */
+  void post_inbox_(timer_inbox_link* l, int64_t due_ns) {
+    size_t backlog = inbox_size_.fetch_add(1, std::memory_order_relaxed) + 1;
+    inbox_.push(l);
+    // pairs with the fence in main, either the timer thread drains this link
+    // before sleeping, or it is seen sleeping here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (due_ns < sleep_until_.load(std::memory_order_relaxed) || backlog == k_inbox_wake_backlog) {
+      this->wake_up_();
+    }
+  }
+  /**
+   * @brief Wait on a virtual clock, the deadline is only a hint for the arms
+   * to wake us up, the owner of the clock wakes us up when the time moves
+  */
+  void wait_virtual_(task_time_t deadline) {
+    sleep_until_.store(to_ns_(deadline), std::memory_order_relaxed);
+    // pairs with the fence in post_inbox_
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->drain_inbox_() > 0) {
+      return;
+    }
+    std::unique_lock<std::mutex> _(cv_l_);
+    // poll in case the clock is replaced without a wake up
+    cv_.wait_for(_, std::chrono::milliseconds(10), [this]() { return wake_flag_; });
+    wake_flag_ = false;
+  }
+
+
+  /**
+   * @brief Timer thread, apply the arms and the cancels in the inbox,
+   * return the count of them
+  */
+  size_t drain_inbox_() {
+    if (engine_changed_.load(std::memory_order_acquire)) {
+      this->switch_engine_();
+    }
+    size_t count = 0;
+    while (timer_inbox_link* l = inbox_.pop()) {
+      ++count;
+      timer_node* n = l->node;
+      if (l == &n->arm_link) {
+        if ((n->ctrl.load(std::memory_order_acquire) & 0xFFu) == k_cancelled) {
+          // the cancel link is behind in the inbox
+          n->place = k_detached;
+        } else {
+          n->seq = ++arm_seq_;
+          engine_->insert(n);
+          n->place = k_in_engine;
+        }
+      } else {
+        if (n->place == k_in_engine) {
+          engine_->erase(n);
+        }
+        this->free_node_(n);
+      }
+    }
+    if (count > 0) {
+      inbox_size_.fetch_sub(count, std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  void switch_engine_() {
+    std::unique_ptr<timer_engine> engine;
+    {
+      std::lock_guard<std::mutex> _(engine_l_);
+      engine = std::move(next_engine_);
+      engine_changed_.store(false, std::memory_order_relaxed);
+    }
+    if (!engine) {
+      return;
+    }
+    std::vector<timer_node*> nodes;
+    engine_->take_all(nodes);
+    for (auto* n : nodes) {
+      engine->insert(n);
+    }
+    engine_ = std::move(engine);
+  }
+
+#if LIBTQ_TIMER_HAS_TIMERFD
+  void open_timerfd_() {
+    tfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    efd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = (tfd_ >= 0 && efd_ >= 0 && epfd_ >= 0);
+    if (ok) {
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.fd = tfd_;
+      ok = (epoll_ctl(epfd_, EPOLL_CTL_ADD, tfd_, &ev) == 0);
+      ev.data.fd = efd_;
+      ok = ok && (epoll_ctl(epfd_, EPOLL_CTL_ADD, efd_, &ev) == 0);
+    }
+    if (!ok) {
+      this->close_timerfd_();
+      backend_ = timer_backend::k_condition_variable;
+    }
+  }
+
+  /**
+   * @brief Close the descriptors, the timer thread should have left the loop
+  */
+  void close_timerfd_() {
+    if (tfd_ >= 0) ::close(tfd_);
+    if (efd_ >= 0) ::close(efd_);
+    if (epfd_ >= 0) ::close(epfd_);
+    tfd_ = efd_ = epfd_ = -1;
+  }
+
+  /**
+   * @brief Arm the timerfd to the absolute deadline, and wait for it or
+   * for a wake up
+  */
+  void wait_timerfd_(task_time_t deadline) {
+    // steady_clock is CLOCK_MONOTONIC
+    auto since = deadline.time_since_epoch();
+    auto sec = std::chrono::duration_cast<std::chrono::seconds>(since);
+    itimerspec its{};
+    its.it_value.tv_sec = (time_t)sec.count();
+    its.it_value.tv_nsec = (long)std::chrono::duration_cast<std::chrono::nanoseconds>(since - sec).count();
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+      // zero disarms the timer
+      its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(tfd_, TFD_TIMER_ABSTIME, &its, nullptr);
+    epoll_event evs[2];
+    int count = epoll_wait(epfd_, evs, 2, -1);
+    for (int i = 0; i < count; ++i) {
+      uint64_t v;
+      ssize_t r = ::read(evs[i].data.fd, &v, sizeof(v));
+      (void)r;
+    }
+  }
+#endif
+
+  /**
+   * @brief The node of a slot, nullptr if the slot does not exist
+  */
+  timer_node* node_at_(uint32_t slot) {
+    uint32_t chunk = slot >> k_chunk_bits;
+    if (chunk >= chunk_count_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return chunks_[chunk].load(std::memory_order_acquire) + (slot & (k_chunk_size - 1));
+  }
+
+  /**
+   * @brief Any thread, take a free node. The free list is a stack of slot
+   * indexes with an ABA tag in the high bits of the head. Nodes are never
+   * freed before the worker, reading a node just taken by others is safe.
+  */
+  timer_node* alloc_node_() {
+    uint64_t head = free_head_.load(std::memory_order_acquire);
+    while (true) {
+      uint32_t slot = (uint32_t)head;
+      if (slot == k_no_slot) {
+        if (!this->grow_()) {
+          return nullptr;
+        }
+        head = free_head_.load(std::memory_order_acquire);
+        continue;
+      }
+      timer_node* n = this->node_at_(slot);
+      uint64_t next = ((head >> 32) + 1) << 32 | n->free_next.load(std::memory_order_relaxed);
+      if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+        return n;
+      }
+    }
+  }
+
+  /**
+   * @brief Push a chain of nodes linked by free_next to the free list
+  */
+  void push_free_(timer_node* first, timer_node* last) {
+    uint64_t head = free_head_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+      last->free_next.store((uint32_t)head, std::memory_order_relaxed);
+      next = ((head >> 32) + 1) << 32 | first->slot;
+    } while (!free_head_.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  static void release_job_(timer_node* n) {
+    n->job = nullptr;
+    n->periodic_job.reset();
+    n->queue.reset();
+  }
+
+  /**
+   * @brief Timer thread, destroy the job and bump the generation so the old
+   * handle is stale, then give the slot back
+  */
+  void free_node_(timer_node* n) {
+    release_job_(n);
+    n->rearmable = false;
+    uint32_t gen = (uint32_t)(n->ctrl.load(std::memory_order_relaxed) >> 32) + 1;
+    if (gen == 0) {
+      gen = 1;
+    }
+    n->ctrl.store(make_ctrl_(gen, k_free), std::memory_order_release);
+    n->place = k_outside;
+    this->push_free_(n, n);
   }
 
   /**
-   * @brief Remove an unfired job in the queue
+   * @brief Add a chunk of free nodes, false when the slot table is full
   */
-  void remove_unfired_job(uint64_t job_id) {
-    std::lock_guard<std::mutex> _(cv_l_);
-    pq_.erase(job_id);
-  }
-
-  void fire_job_wrapper(task_location loc, 
-    task_time_t ft, unsigned int interval, 
-    tq_wt related_tq, std::shared_ptr<bool> st, task_t job
-  ) {
-    if (!st || *st == false) {
-      // stop the timer
-      return;
-    }
-    if (job) {
-      if (auto tq = related_tq.lock()) {
-        tq->post_task(loc, job, 1); // the job should be set to the header of the task queue
-      }
+  bool grow_() {
+    std::lock_guard<std::mutex> _(grow_l_);
+    if ((uint32_t)free_head_.load(std::memory_order_acquire) != k_no_slot) {
+      // grown by another thread
+      return true;
     }
-    auto now = std::chrono::steady_clock::now();
-    auto next_ft = ft + std::chrono::milliseconds(interval);
-    if (next_ft <= now) {
-      auto catch_up = std::chrono::duration_cast<std::chrono::milliseconds>(now - next_ft).count() / interval;
-      next_ft += std::chrono::milliseconds(interval * catch_up);
+    uint32_t chunk = chunk_count_.load(std::memory_order_relaxed);
+    if (chunk >= k_max_chunks) {
+      return false;
     }
-    while (next_ft <= now) {
-      next_ft += std::chrono::milliseconds(interval);
+    timer_node* nodes = new timer_node[k_chunk_size];
+    for (uint32_t i = 0; i < k_chunk_size; ++i) {
+      timer_node& n = nodes[i];
+      n.slot = (chunk << k_chunk_bits) + i;
+      n.ctrl.store(make_ctrl_(1, k_free), std::memory_order_relaxed);
+      n.free_next.store(n.slot + 1, std::memory_order_relaxed);
+      n.arm_link.node = &n;
+      n.cancel_link.node = &n;
     }
-    this->add_next_job(next_ft, loc, [=](task_time_t last_ft) {
-      timer_inner_worker::instance().fire_job_wrapper(loc, last_ft, interval, related_tq, st, job);
-    });
+    chunks_[chunk].store(nodes, std::memory_order_release);
+    chunk_count_.store(chunk + 1, std::memory_order_release);
+    this->push_free_(&nodes[0], &nodes[k_chunk_size - 1]);
+    return true;
   }
-protected:
 
   /**
-   * @brief start the inner waiting loop
+   * @brief Pop all the due jobs in one pass, or get the time to the next deadline
   */
-  timer_inner_worker() : 
-    thread(make_thread_attribute(k_thread_attribute_default_stack_size, nullptr, thread_priority::k_realtime, "libtq_timer"))
-  {
-    this->start();
+  std::tuple<bool, duration_t> collect_due_jobs_() {
+    duration_t d = std::chrono::milliseconds(1000);
+    auto now = task_now();
+    // Already timedout, or close enough to pick up now
+    auto pickup = now + std::chrono::microseconds(LIBTQ_PICKUP_EST_TIME);
+    while (timer_node* n = engine_->pop_due(pickup)) {
+      n->place = k_detached;
+      uint32_t gen = (uint32_t)(n->ctrl.load(std::memory_order_relaxed) >> 32);
+      uint64_t c = make_ctrl_(gen, k_armed);
+      if (!n->ctrl.compare_exchange_strong(c, make_ctrl_(gen, k_firing), std::memory_order_acq_rel)) {
+        // cancelled, freed by its cancel link
+        continue;
+      }
+      if (n->interval == duration_t::zero()) {
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      due_.push_back(n);
+    }
+    if (due_.empty()) {
+      auto next = engine_->next_deadline();
+      if (next != task_time_t::max()) {
+        d = next - now;
+      }
+    }
+    return std::make_tuple(!due_.empty(), d);
   }
 
-  std::tuple<bool, priority_job, duration_t> get_top_fire_job() {
-    bool has_fire_job = false;
-    priority_job pj{};
-    duration_t d = std::chrono::milliseconds(1000);
-    std::lock_guard<std::mutex> _(cv_l_);
-    if (pq_.size() > 0) {
-      const auto& i = pq_.top();
-      auto n = std::chrono::steady_clock::now();
-      auto dlt = std::abs(std::chrono::duration_cast<std::chrono::microseconds>(n - i.fire_time).count());
-      // Already timedout
-      if (i.fire_time <= n || dlt <= LIBTQ_PICKUP_EST_TIME) {
-        pj = i;
-        pq_.pop();
-        has_fire_job = true;
+  /**
+   * @brief Post the collected jobs grouped by the target queue, one bulk post
+   * per queue in the fire order. Then free the one shot jobs and re-arm the
+   * periodic jobs with the same node and slot.
+  */
+  void fire_due_jobs_() {
+    for (timer_node* n : due_) {
+      tq_st q = n->queue.lock();
+      if (n->rearmable) {
+        // copy what is posted first, once idle the node belongs to its owner
+        auto job = n->periodic_job;
+        fire_entry e{q.get(), n->direction, n->fire_time, n->seq, std::move(q), located_task{n->loc, nullptr}};
+        uint32_t gen = (uint32_t)(n->ctrl.load(std::memory_order_relaxed) >> 32);
+        uint64_t c = make_ctrl_(gen, k_firing);
+        if (!n->ctrl.compare_exchange_strong(c, make_ctrl_(gen, k_idle), std::memory_order_acq_rel)) {
+          // removed while firing, the node waits for its cancel link
+          release_job_(n);
+          continue;
+        }
+        if (e.queue) {
+          e.lt.t = [job]() { (*job)(); };
+          fires_.push_back(std::move(e));
+        }
+        continue;
+      }
+      if (!q) {
+        continue;
+      }
+      task_t t;
+      if (n->interval == duration_t::zero()) {
+        t = std::move(n->job);
       } else {
-        d = i.fire_time - n;
+        auto job = n->periodic_job;
+        t = [job]() { (*job)(); };
+      }
+      task_queue* key = q.get();
+      fires_.push_back(fire_entry{key, n->direction, n->fire_time, n->seq, std::move(q), located_task{n->loc, std::move(t)}});
+    }
+    // sort in place, a queue gets its jobs in fire time and arm order
+    std::sort(fires_.begin(), fires_.end(), [](const fire_entry& a, const fire_entry& b) {
+      return std::tie(a.key, a.direction, a.fire_time, a.seq) < std::tie(b.key, b.direction, b.fire_time, b.seq);
+    });
+    for (size_t i = 0; i < fires_.size();) {
+      size_t j = i;
+      for (; j < fires_.size() && fires_[j].key == fires_[i].key && fires_[j].direction == fires_[i].direction; ++j) {
+        batch_.push_back(std::move(fires_[j].lt));
       }
+      // timer jobs are set to the header of the task queue, delayed posts to the tail
+      fires_[i].queue->post_tasks(std::move(batch_), fires_[i].direction);
+      batch_.clear();
+      i = j;
     }
-    return std::make_tuple(has_fire_job, std::move(pj), d);
+    fires_.clear();
+
+    auto now = task_now();
+    for (timer_node* n : due_) {
+      if (n->rearmable) {
+        continue;
+      }
+      if (n->interval == duration_t::zero()) {
+        this->free_node_(n);
+        continue;
+      }
+      uint32_t gen = (uint32_t)(n->ctrl.load(std::memory_order_relaxed) >> 32);
+      uint64_t c = make_ctrl_(gen, k_firing);
+      if (!n->ctrl.compare_exchange_strong(c, make_ctrl_(gen, k_armed), std::memory_order_acq_rel)) {
+        // removed while firing, the node waits for its cancel link
+        release_job_(n);
+        continue;
+      }
+      auto next_ft = n->fire_time + n->interval;
+      if (next_ft <= now) {
+        // skip the missed periods
+        next_ft += n->interval * ((now - next_ft) / n->interval + 1);
+      }
+      n->fire_time = next_ft;
+      engine_->insert(n);
+      n->place = k_in_engine;
+    }
+    due_.clear();
   }
 
   void main() override {
@@ -217,77 +1241,324 @@ protected:
 #ifdef _WIN32
     // timeBeginPeriod(1);
     adjust_timer_resolution_high();
+#endif
+#if defined(__linux__)
+    // the default 50us slack delays every wake up of a non realtime thread
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
 #endif
     while (this->is_validate()) {  
-      auto r = get_top_fire_job();
+      sleep_until_.store(k_awake, std::memory_order_relaxed);
+      // read before the drain, a job armed before the clock moved to it is
+      // either drained in this pass or its pass is not published
+      int64_t pass_ns = to_ns_(task_now());
+      this->drain_inbox_();
+      auto r = this->collect_due_jobs_();
       if (std::get<0>(r) == true) {
-        std::get<1>(r).job(std::get<1>(r).fire_time);
+        this->fire_due_jobs_();
       } else {
+        passed_ns_.store(pass_ns, std::memory_order_release);
+        task_clock* clock = get_task_clock();
+        if (clock != nullptr && clock->is_virtual()) {
+          // the time only moves by the clock owner, who wakes us up
+          this->wait_virtual_(clock->now() + std::get<1>(r));
+          continue;
+        }
 #ifdef __APPLE__
         // We don't need to sleep if the delta is less than 100us
         size_t wait_offset = 0;
-        if (std::get<2>(r) <= std::chrono::microseconds(LIBTQ_PICKUP_EST_TIME * 3)) {
+        if (std::get<1>(r) <= std::chrono::microseconds(LIBTQ_PICKUP_EST_TIME * 3)) {
           // let the loop to re-run 3 times, and post the task directly
           // use a spin loop to imporve the reslution
           continue;
-        } else if (std::get<2>(r) <= std::chrono::microseconds(500)) {
+        } else if (std::get<1>(r) <= std::chrono::microseconds(500)) {
           // [pku_est * 5, 500]
           wait_offset = LIBTQ_PICKUP_EST_TIME * 3;
-        } else if (std::get<2>(r) <= std::chrono::microseconds(1000)) {
+        } else if (std::get<1>(r) <= std::chrono::microseconds(1000)) {
           // (500, 1000]
           wait_offset = 449;
         } else {
           // 
           wait_offset = 899;
         }
-        auto wait_delta = std::get<2>(r) - std::chrono::microseconds(wait_offset);
+        auto wait_delta = std::get<1>(r) - std::chrono::microseconds(wait_offset);
 #elif defined(_WIN32)
         size_t wait_offset = 0;
-        if (std::get<2>(r) <= std::chrono::microseconds(LIBTQ_PICKUP_EST_TIME * 3)) {
+        if (std::get<1>(r) <= std::chrono::microseconds(LIBTQ_PICKUP_EST_TIME * 3)) {
           continue;
-        } else if (std::get<2>(r) <= std::chrono::microseconds(500)) {
+        } else if (std::get<1>(r) <= std::chrono::microseconds(500)) {
           // Nt Timer Resolution is 500 microseconds, try to yield the thread and retry the loop
           for (int i = 0; i < 3; ++i) {
             std::this_thread::yield();
           }
           continue;
         } else {
-          wait_offset = (size_t)(std::chrono::duration_cast<std::chrono::microseconds>(std::get<2>(r)).count() / 500l - 1) * 500u;
+          wait_offset = (size_t)(std::chrono::duration_cast<std::chrono::microseconds>(std::get<1>(r)).count() / 500l - 1) * 500u;
           wait_offset -= LIBTQ_PICKUP_EST_TIME;
         }
         auto wait_delta = std::chrono::microseconds(wait_offset);
-#endif
-        std::unique_lock<std::mutex> _(cv_l_);
-        // if the wait_for broken before timeout, next loop will 
-        // continue to wait until timeout, so do not need pred here.
-#ifdef __APPLE__
-        cv_.wait_for(_, wait_delta);
-#elif defined(_WIN32)
-        cv_.wait_for(_, wait_delta);
+#elif defined(__linux__)
+        // sleep until the spin threshold before the deadline, then spin the rest,
+        // waking up from a sleep is not precise enough for sub millisecond timers
+        duration_t spin = spin_threshold_.load(std::memory_order_relaxed);
+        if (std::get<1>(r) <= spin) {
+          std::this_thread::yield();
+          continue;
+        }
+        duration_t wait_delta = std::get<1>(r) - spin;
 #else
-        cv_.wait_for(_, std::get<2>(r));
+        duration_t wait_delta = std::get<1>(r);
+#endif
+        task_time_t wake_time = std::chrono::steady_clock::now() + wait_delta;
+        // the deadlines are on the library clock, the sleep is on steady_clock
+        sleep_until_.store(to_ns_(task_now() + wait_delta), std::memory_order_relaxed);
+        // pairs with the fence in post_inbox_
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->drain_inbox_() > 0) {
+          // posted before the sleep time was published
+          continue;
+        }
+#if LIBTQ_TIMER_HAS_TIMERFD
+        if (backend_ == timer_backend::k_timerfd) {
+          this->wait_timerfd_(wake_time);
+          continue;
+        }
 #endif
+        std::unique_lock<std::mutex> _(cv_l_);
+        cv_.wait_until(_, wake_time, [this]() { return wake_flag_; });
+        wake_flag_ = false;
       }
     }
 #ifdef _WIN32
     // timeEndPeriod(1);
     adjust_timer_resolution_default();
 #endif
+    running_.store(false, std::memory_order_release);
   }
 protected:
   /**
-   * @brief Inner Poll wrapper
+   * @brief Inner Poll wrapper, only to sleep on, the jobs are not locked
   */
   std::condition_variable cv_;
   std::mutex cv_l_;
+  bool wake_flag_;
+
+  /**
+   * @brief Index of the shard, kept in the handles
+  */
+  uint32_t index_;
+
+  /**
+   * @brief Pending jobs, order by fire time, only used by the timer thread
+  */
+  std::unique_ptr<timer_engine> engine_;
+  std::mutex                    engine_l_;
+  std::unique_ptr<timer_engine> next_engine_;
+  std::atomic<bool>             engine_changed_;
+
+  /**
+   * @brief Slot table of the nodes, in chunks never moved or freed before
+   * the worker, a handle is a slot and its generation
+  */
+  std::atomic<timer_node*>  chunks_[k_max_chunks];
+  std::atomic<uint32_t>     chunk_count_;
+  std::mutex                grow_l_;
+  std::atomic<uint64_t>     free_head_;
+  std::atomic<size_t>       pending_;
+
+  /**
+   * @brief Arms and cancels from other threads, drained by the timer thread
+  */
+  mpsc_queue<timer_inbox_link> inbox_;
+  std::atomic<size_t>       inbox_size_;
+  /**
+   * @brief Time the timer thread sleeps to in nanoseconds, or k_awake
+  */
+  std::atomic<int64_t>      sleep_until_;
+  /**
+   * @brief Clock time of the last pass with nothing due, see sync_to
+  */
+  std::atomic<int64_t>      passed_ns_;
+  std::atomic<bool>         running_;
+
+  /**
+   * @brief Timer thread, the jobs of one fire pass and their posts, the
+   * capacity is kept for the next pass
+  */
+  struct fire_entry {
+    task_queue*   key;
+    int           direction;
+    task_time_t   fire_time;
+    uint64_t      seq;
+    tq_st         queue;
+    located_task  lt;
+  };
+  uint64_t                  arm_seq_;
+  std::vector<timer_node*>  due_;
+  std::vector<fire_entry>   fires_;
+  task_batch_t              batch_;
+
+#if LIBTQ_TIMER_HAS_TIMERFD
+  /**
+   * @brief epoll on the deadline timerfd and the wake up eventfd
+  */
+  int                     epfd_;
+  int                     tfd_;
+  int                     efd_;
+#endif
+  std::atomic<timer_backend> backend_;
+  std::atomic<duration_t>   spin_threshold_;
+};
+
+/**
+ * @brief Timer shards, each one has its own thread and engine.
+ * Shards are created on demand and never destroyed before exit, so the
+ * handles of a shard stay valid when the shard count is lowered.
+*/
+class timer_shards {
+public:
+  enum { k_max_shards = 64 };
+
+  static timer_shards& instance() {
+    static timer_shards g_ts;
+    return g_ts;
+  }
+
+  /**
+   * @brief The shard of a handle
+  */
+  timer_inner_worker* at(uint32_t index) {
+    return (index < k_max_shards) ? workers_[index].load(std::memory_order_acquire) : nullptr;
+  }
+
+  /**
+   * @brief The shard to arm a timer targeting the queue
+  */
+  timer_inner_worker& pick(const void* target_queue) {
+    if (policy_.load(std::memory_order_relaxed) == timer_shard_policy::k_by_queue) {
+      return this->pick_by_queue(target_queue);
+    }
+    size_t count = count_.load(std::memory_order_acquire);
+    size_t index = (count > 1 ? current_cpu_() % count : 0);
+    return *workers_[index].load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief The shard of the queue whatever the policy is
+  */
+  timer_inner_worker& pick_by_queue(const void* target_queue) {
+    size_t count = count_.load(std::memory_order_acquire);
+    size_t index = 0;
+    if (count > 1) {
+      // pointers are aligned, mix the high bits in
+      uint64_t h = (uint64_t)(uintptr_t)target_queue * 0x9E3779B97F4A7C15ull;
+      index = (size_t)(h >> 32) % count;
+    }
+    return *workers_[index].load(std::memory_order_acquire);
+  }
+
+  void configure(size_t count, timer_shard_policy policy) {
+    if (count == 0) count = 1;
+    if (count > k_max_shards) count = k_max_shards;
+    std::lock_guard<std::mutex> _(l_);
+    for (size_t i = 0; i < count; ++i) {
+      this->create_(i);
+    }
+    policy_ = policy;
+    count_ = count;
+  }
 
   /**
-   * @brief Inner min-queue, order by task's fire time
+   * @brief Run f on every created shard
   */
-  removable_priority_queue<priority_job, uint64_t> pq_;
+  template < typename _F >
+  void for_each(_F&& f) {
+    for (size_t i = 0; i < k_max_shards; ++i) {
+      if (auto* w = workers_[i].load(std::memory_order_acquire)) {
+        f(*w);
+      }
+    }
+  }
+
+  void set_engine(timer_engine_type type, duration_t tick) {
+    std::lock_guard<std::mutex> _(l_);
+    engine_type_ = type;
+    tick_ = tick;
+    this->for_each([&](timer_inner_worker& w) { w.set_engine(type, tick); });
+  }
+
+  bool set_backend(timer_backend backend) {
+    std::lock_guard<std::mutex> _(l_);
+    bool ok = true;
+    this->for_each([&](timer_inner_worker& w) { ok = w.set_backend(backend) && ok; });
+    if (ok) backend_ = backend;
+    return ok;
+  }
+
+  void set_spin_threshold(duration_t threshold) {
+    std::lock_guard<std::mutex> _(l_);
+    spin_threshold_ = threshold;
+    this->for_each([&](timer_inner_worker& w) { w.set_spin_threshold(threshold); });
+  }
+
+protected:
+  timer_shards() :
+#if LIBTQ_TIMER_USE_WHEEL
+    engine_type_(timer_engine_type::k_wheel), tick_(std::chrono::microseconds(LIBTQ_TIMER_WHEEL_TICK_US)),
+#else
+    engine_type_(timer_engine_type::k_heap), tick_(duration_t::zero()),
+#endif
+#if LIBTQ_TIMER_USE_TIMERFD && LIBTQ_TIMER_HAS_TIMERFD
+    backend_(timer_backend::k_timerfd),
+#else
+    backend_(timer_backend::k_condition_variable),
+#endif
+    spin_threshold_(std::chrono::microseconds(LIBTQ_TIMER_SPIN_US)),
+    count_(0), policy_(timer_shard_policy::k_by_queue)
+  {
+    for (auto& w : workers_) {
+      w = nullptr;
+    }
+    this->configure(LIBTQ_TIMER_SHARDS, timer_shard_policy::k_by_queue);
+  }
+  ~timer_shards() {
+    for (auto& w : workers_) {
+      delete w.load();
+    }
+  }
+
+  void create_(size_t index) {
+    if (workers_[index].load(std::memory_order_relaxed) != nullptr) return;
+    if (index == 0) {
+      snprintf(names_[index], sizeof(names_[index]), "libtq_timer");
+    } else {
+      snprintf(names_[index], sizeof(names_[index]), "libtq_timer_%u", (unsigned int)index);
+    }
+    workers_[index].store(new timer_inner_worker(
+      (uint32_t)index, names_[index], engine_type_, tick_, backend_, spin_threshold_
+    ), std::memory_order_release);
+  }
+
+  static size_t current_cpu_() {
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0) return (size_t)cpu;
+#endif
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+  }
+
+protected:
+  std::mutex                        l_;
+  timer_engine_type                 engine_type_;
+  duration_t                        tick_;
+  timer_backend                     backend_;
+  duration_t                        spin_threshold_;
+  std::atomic<size_t>               count_;
+  std::atomic<timer_shard_policy>   policy_;
+  std::atomic<timer_inner_worker*>  workers_[k_max_shards];
+  char                              names_[k_max_shards][16];
 };
 
-timer::timer(tq_wt related_tq) : status_(new bool), related_tq_(related_tq) {}
+timer::timer(tq_wt related_tq) : handle_(), related_tq_(related_tq) {}
 timer::~timer() {
   this->stop();
 }
@@ -299,53 +1570,399 @@ tq_wt timer::related_queue() const {
 }
 
 /**
- * @brief Start the timer
+ * @brief Start the timer, a running timer is stopped first
 */
 void timer::start(task_location loc, task_t job, unsigned int ms, bool fire_now) {
-  if (!job || ms == 0) return;
-  *status_ = true;
-  auto now = std::chrono::steady_clock::now();
-  auto next_ft = now + std::chrono::milliseconds(ms);
-  auto rtq = this->related_tq_;
-  auto st = this->status_;
-  timer_inner_worker::instance().add_next_job(next_ft, loc, [=](task_time_t) {
-    timer_inner_worker::instance().fire_job_wrapper(loc, next_ft, ms, rtq, st, job);
-  });
+  this->start(loc, std::move(job), duration_t(std::chrono::milliseconds(ms)), duration_t::zero(), fire_now);
+}
+
+/**
+ * @brief Start the timer, each fire can be delayed up to leeway
+ * to share the wake up with other timers
+*/
+void timer::start(task_location loc, task_t job, unsigned int ms, duration_t leeway, bool fire_now) {
+  this->start(loc, std::move(job), duration_t(std::chrono::milliseconds(ms)), leeway, fire_now);
+}
+
+/**
+ * @brief Start the timer with any interval
+*/
+void timer::start(task_location loc, task_t job, duration_t interval, bool fire_now) {
+  this->start(loc, std::move(job), interval, duration_t::zero(), fire_now);
+}
+
+/**
+ * @brief Start the timer with any interval, each fire can be delayed up to leeway
+*/
+void timer::start(task_location loc, task_t job, duration_t interval, duration_t leeway, bool fire_now) {
+  if (!job || interval <= duration_t::zero()) return;
+  this->stop();
+  auto next_ft = task_now() + interval;
+  // the job is fired many times, share it between the posted tasks
+  auto sjob = std::make_shared<task_t>(std::move(job));
+  auto& shard = timer_shards::instance().pick(this->related_tq_.lock().get());
+  handle_ = shard.add_periodic_job(next_ft, loc, this->related_tq_, sjob, interval, leeway);
   if (fire_now) {
     if (auto tq = this->related_tq_.lock()) {
-      tq->post_task(loc, job);
+      tq->post_task(loc, [sjob]() { (*sjob)(); });
     }
   }
 }
 
 /**
- * @brief Stop the timer
+ * @brief Stop the timer, it is removed from the pending jobs right away
 */
 void timer::stop() {
-  if (status_) {
-    *status_ = false;
+  if (handle_) {
+    if (auto* shard = timer_shards::instance().at(handle_.shard)) {
+      shard->remove_unfired_job(handle_);
+    }
+    handle_ = timer_handle{};
   }
 }
 
 /**
  * @brief Start a job after some time to related task queue
 */
-uint64_t timer::once_after(tq_wt related_tq, task_location loc, task_t job, unsigned int delay_ms) {
-  if (!job || delay_ms == 0) return (uint64_t)-1;
-  auto next_fire_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
-  return timer_inner_worker::instance().add_next_job(next_fire_time, loc, [=](task_time_t) {
-    if (auto tq = related_tq.lock()) {
-      tq->post_task(loc, job, 1);
-    }
-  });
+timer_handle timer::once_after(tq_wt related_tq, task_location loc, task_t job, unsigned int delay_ms) {
+  return timer::once_after(related_tq, loc, std::move(job),
+    duration_t(std::chrono::milliseconds(delay_ms)), duration_t::zero());
+}
+
+/**
+ * @brief Start a job after some time to related task queue,
+ * it can be delayed up to leeway to share the wake up with other timers
+*/
+timer_handle timer::once_after(tq_wt related_tq, task_location loc, task_t job, unsigned int delay_ms, duration_t leeway) {
+  return timer::once_after(related_tq, loc, std::move(job),
+    duration_t(std::chrono::milliseconds(delay_ms)), leeway);
+}
+
+/**
+ * @brief Start a job after any delay to related task queue
+*/
+timer_handle timer::once_after(tq_wt related_tq, task_location loc, task_t job, duration_t delay) {
+  return timer::once_after(related_tq, loc, std::move(job), delay, duration_t::zero());
+}
+
+/**
+ * @brief Start a job after any delay to related task queue,
+ * it can be delayed up to leeway to share the wake up with other timers
+*/
+timer_handle timer::once_after(tq_wt related_tq, task_location loc, task_t job, duration_t delay, duration_t leeway) {
+  if (!job || delay <= duration_t::zero()) return timer_handle{};
+  auto next_fire_time = task_now() + delay;
+  auto& shard = timer_shards::instance().pick(related_tq.lock().get());
+  return shard.add_next_job(next_fire_time, loc, related_tq, std::move(job), leeway);
 }
 /**
  * @brief Cancel an un-fired delay job
 */
-void timer::cancel_once(uint64_t job_id) {
-  timer_inner_worker::instance().remove_unfired_job(job_id);
+void timer::cancel_once(timer_handle handle) {
+  if (!handle) return;
+  if (auto* shard = timer_shards::instance().at(handle.shard)) {
+    shard->remove_unfired_job(handle);
+  }
+}
+
+/**
+ * @brief Select the engine to keep the pending jobs
+*/
+void timer::set_engine(timer_engine_type type, duration_t tick) {
+  timer_shards::instance().set_engine(type, tick);
+}
+
+/**
+ * @brief Select how the timer thread sleeps
+*/
+bool timer::set_backend(timer_backend backend) {
+  return timer_shards::instance().set_backend(backend);
+}
+
+/**
+ * @brief Spin instead of sleeping when the next deadline is closer than the threshold
+*/
+void timer::set_spin_threshold(duration_t threshold) {
+  timer_shards::instance().set_spin_threshold(threshold);
+}
+
+/**
+ * @brief Count of the pending jobs of all timers
+*/
+size_t timer::pending_count() {
+  size_t count = 0;
+  timer_shards::instance().for_each([&count](timer_inner_worker& w) {
+    count += w.pending_count();
+  });
+  return count;
+}
+
+/**
+ * @brief Wait for every shard to pass the current clock time
+*/
+void timer::sync_to_clock() {
+  task_time_t now = task_now();
+  timer_shards::instance().for_each([now](timer_inner_worker& w) {
+    w.sync_to(now);
+  });
+}
+
+/**
+ * @brief Run timers on count shards, each one has its own thread and engine
+*/
+void timer::set_shards(size_t count, timer_shard_policy policy) {
+  timer_shards::instance().configure(count, policy);
+}
+
+/**
+ * @brief Post a job to the tail of the related queue at the time, on the shard
+ * of the queue whatever the shard policy is, so its engine keeps them in deadline order
+*/
+timer_handle timer::post_at(tq_wt related_tq, task_location loc, task_t job, task_time_t time) {
+  if (!job) return timer_handle{};
+  auto& shard = timer_shards::instance().pick_by_queue(related_tq.lock().get());
+  return shard.add_next_job(time, loc, related_tq, std::move(job), duration_t::zero(), 0);
+}
+
+/**
+ * @brief Add the re-armable timer job of a debouncer or a throttler, its
+ * deadlines go to the shard of the queue like the delayed posts. The posted
+ * job carries the id, the one of a replaced timer job is ignored.
+*/
+template < typename _State >
+static void make_timer_job_(const std::shared_ptr<_State>& st, void (*fire)(const std::shared_ptr<_State>&, uint32_t)) {
+  uint32_t id = st->job_id.load(std::memory_order_relaxed) + 1;
+  st->job_id.store(id, std::memory_order_relaxed);
+  auto job = std::make_shared<task_t>([st, id, fire]() { fire(st, id); });
+  auto& shard = timer_shards::instance().pick_by_queue(st->related_tq.lock().get());
+  st->handle = shard.add_idle_job(st->loc, st->related_tq, std::move(job), 0);
+}
+
+/**
+ * @brief Arm the timer job of a debouncer or a throttler again, the lock is held
+*/
+template < typename _State >
+static bool rearm_timer_job_(_State& st, task_time_t t) {
+  // a fire for a gone queue is dropped and would keep the job armed forever
+  if (!st.handle || st.related_tq.expired()) {
+    return false;
+  }
+  auto* shard = timer_shards::instance().at(st.handle.shard);
+  return shard != nullptr && shard->rearm_job(st.handle, t);
+}
+
+/**
+ * @brief Shared by the debouncer and its timer job, the job runs on the
+ * related queue. last_ns is the time of the last trigger not run yet.
+*/
+struct debouncer::state {
+  tq_wt                 related_tq;
+  task_location         loc;
+  task_t                job;
+  duration_t            window;
+  std::atomic<int64_t>  last_ns;
+  std::atomic<bool>     armed;
+  std::atomic<bool>     alive;
+  // one timer job armed again for each window, replaced by cancel
+  std::mutex            l;
+  timer_handle          handle;
+  std::atomic<uint32_t> job_id;
+
+  static constexpr int64_t k_none = std::numeric_limits<int64_t>::min();
+
+  static int64_t now_ns() {
+    return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      task_now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief Called with armed set, reset it if the timer job could not be armed
+   * so the next trigger tries again
+  */
+  static void arm(const std::shared_ptr<state>& st, int64_t due_ns) {
+    std::lock_guard<std::mutex> _(st->l);
+    if (!rearm_timer_job_(*st, task_time_t(duration_t(due_ns)))) {
+      st->armed = false;
+    }
+  }
+
+  static void fire(const std::shared_ptr<state>& st, uint32_t id) {
+    if (!st->alive || id != st->job_id.load(std::memory_order_acquire)) return;
+    st->armed = false;
+    // a trigger from now on arms again, or is seen below
+    int64_t t = st->last_ns.load();
+    if (t == k_none) {
+      // cancelled
+      return;
+    }
+    int64_t due = t + (int64_t)st->window.count();
+    // the timer picks up a job a little early, it is due already
+    int64_t pickup = (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::microseconds(LIBTQ_PICKUP_EST_TIME)).count();
+    if (now_ns() < due - pickup || !st->last_ns.compare_exchange_strong(t, k_none)) {
+      // triggered again in the window
+      if (!st->armed.exchange(true)) {
+        state::arm(st, st->last_ns.load() + (int64_t)st->window.count());
+      }
+      return;
+    }
+    st->job();
+  }
+};
+
+debouncer::debouncer(tq_wt related_tq, task_location loc, task_t job, duration_t window) :
+  state_(std::make_shared<state>())
+{
+  state_->related_tq = related_tq;
+  state_->loc = loc;
+  state_->job = std::move(job);
+  state_->window = window;
+  state_->last_ns = state::k_none;
+  state_->armed = false;
+  state_->alive = true;
+  state_->job_id = 0;
+  std::lock_guard<std::mutex> _(state_->l);
+  make_timer_job_(state_, &state::fire);
+}
+
+debouncer::~debouncer() {
+  state_->alive = false;
+  // the timer job keeps the state, remove it
+  std::lock_guard<std::mutex> _(state_->l);
+  timer::cancel_once(state_->handle);
+  state_->handle = timer_handle{};
+}
+
+void debouncer::trigger() {
+  if (!state_->job) return;
+  int64_t now = state::now_ns();
+  state_->last_ns.store(now);
+  if (!state_->armed.exchange(true)) {
+    state::arm(state_, now + (int64_t)state_->window.count());
+  }
+}
+
+void debouncer::cancel() {
+  std::lock_guard<std::mutex> _(state_->l);
+  // a removed job is gone for good, the next window arms a new one
+  timer::cancel_once(state_->handle);
+  make_timer_job_(state_, &state::fire);
+  state_->armed = false;
+  state_->last_ns.store(state::k_none);
+}
+
+/**
+ * @brief Shared by the throttler and its jobs, the job runs on the related queue.
+*/
+struct throttler::state {
+  enum : uint32_t {
+    k_idle          = 0,
+    // the window is open, nothing to run at the end
+    k_open          = 1,
+    // the window is open, run at the end
+    k_open_pending  = 2
+  };
+
+  tq_wt                 related_tq;
+  task_location         loc;
+  task_t                job;
+  duration_t            window;
+  std::atomic<uint32_t> phase;
+  std::atomic<bool>     alive;
+  // one timer job armed again for the end of each window, replaced by cancel
+  std::mutex            l;
+  timer_handle          handle;
+  std::atomic<uint32_t> job_id;
+  task_time_t           window_end_time;
+
+  static void open_window(const std::shared_ptr<state>& st) {
+    std::lock_guard<std::mutex> _(st->l);
+    st->window_end_time = task_now() + st->window;
+    if (!rearm_timer_job_(*st, st->window_end_time)) {
+      // no window end will come, the next trigger opens a new window
+      st->phase = k_idle;
+    }
+  }
+
+  static void window_end(const std::shared_ptr<state>& st, uint32_t id) {
+    if (id != st->job_id.load(std::memory_order_acquire)) return;
+    uint32_t p = st->phase.load();
+    while (true) {
+      if (p == k_open_pending) {
+        if (st->phase.compare_exchange_weak(p, k_open)) {
+          if (st->alive) st->job();
+          state::open_window(st);
+          return;
+        }
+      } else if (p == k_open) {
+        if (st->phase.compare_exchange_weak(p, k_idle)) {
+          return;
+        }
+      } else {
+        return;
+      }
+    }
+  }
+};
+
+throttler::throttler(tq_wt related_tq, task_location loc, task_t job, duration_t window) :
+  state_(std::make_shared<state>())
+{
+  state_->related_tq = related_tq;
+  state_->loc = loc;
+  state_->job = std::move(job);
+  state_->window = window;
+  state_->phase = state::k_idle;
+  state_->alive = true;
+  state_->job_id = 0;
+  std::lock_guard<std::mutex> _(state_->l);
+  make_timer_job_(state_, &state::window_end);
+}
+
+throttler::~throttler() {
+  state_->alive = false;
+  // the timer job keeps the state, remove it
+  std::lock_guard<std::mutex> _(state_->l);
+  timer::cancel_once(state_->handle);
+  state_->handle = timer_handle{};
+}
+
+void throttler::trigger() {
+  if (!state_->job) return;
+  uint32_t p = state_->phase.load();
+  while (true) {
+    if (p == state::k_idle) {
+      if (state_->phase.compare_exchange_weak(p, state::k_open)) {
+        if (auto tq = state_->related_tq.lock()) {
+          auto st = state_;
+          tq->post_task(st->loc, [st]() {
+            if (st->alive) st->job();
+          });
+        }
+        state::open_window(state_);
+        return;
+      }
+    } else if (p == state::k_open) {
+      if (state_->phase.compare_exchange_weak(p, state::k_open_pending)) {
+        return;
+      }
+    } else {
+      return;
+    }
+  }
 }
 
+void throttler::cancel() {
+  std::lock_guard<std::mutex> _(state_->l);
+  // a removed job is gone for good, a new one ends the current window
+  timer::cancel_once(state_->handle);
+  make_timer_job_(state_, &state::window_end);
+  uint32_t p = state::k_open_pending;
+  state_->phase.compare_exchange_strong(p, state::k_open);
+  if (p != state::k_idle && !rearm_timer_job_(*state_, state_->window_end_time)) {
+    state_->phase = state::k_idle;
+  }
+}
 
 } // namespace libtq
 
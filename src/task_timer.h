@@ -38,6 +38,36 @@ SOFTWARE.
 
 namespace libtq {
 
+/**
+ * @brief Storage of the pending timer jobs
+ * k_heap:  binary heap, exact fire time, O(log n) insert and cancel
+ * k_wheel: hierarchical timing wheel, fires on tick boundaries, O(1) insert and cancel
+*/
+enum class timer_engine_type {
+  k_heap,
+  k_wheel
+};
+
+/**
+ * @brief How the timer thread sleeps until the next deadline
+ * k_condition_variable: timed wait on a condition variable, every platform
+ * k_timerfd: absolute CLOCK_MONOTONIC timerfd and an eventfd in one epoll_wait, Linux only
+*/
+enum class timer_backend {
+  k_condition_variable,
+  k_timerfd
+};
+
+/**
+ * @brief How a timer is assigned to a timer shard
+ * k_by_queue: hash of the target task queue, timers of one queue share a shard
+ * k_by_cpu: the cpu of the thread arming the timer
+*/
+enum class timer_shard_policy {
+  k_by_queue,
+  k_by_cpu
+};
+
 class timer {
 public: 
   timer(tq_wt related_tq);
@@ -49,12 +79,24 @@ public:
   timer& operator =(timer&&) = delete;
 
   /**
-   * @brief Start the timer
+   * @brief Start the timer, a running timer is stopped first
   */
   void start(task_location loc, task_t job, unsigned int ms, bool fire_now = false);
 
   /**
-   * @brief Stop the timer
+   * @brief Start the timer, each fire can be delayed up to leeway,
+   * timers with overlapping windows are fired in one wake up
+  */
+  void start(task_location loc, task_t job, unsigned int ms, duration_t leeway, bool fire_now = false);
+
+  /**
+   * @brief Start the timer with any interval, e.g. std::chrono::microseconds(250)
+  */
+  void start(task_location loc, task_t job, duration_t interval, bool fire_now = false);
+  void start(task_location loc, task_t job, duration_t interval, duration_t leeway, bool fire_now = false);
+
+  /**
+   * @brief Stop the timer, it is removed from the pending jobs right away
   */
   void stop();
 
@@ -64,25 +106,146 @@ public:
   tq_wt related_queue() const;
 
   /**
-   * @brief Start a job after some time to related task queue
+   * @brief Start a job after some time to related task queue,
+   * return an empty handle if the job is empty or the delay is 0
+  */
+  static timer_handle once_after(tq_wt related_tq, task_location loc, task_t job, unsigned int delay_ms);
+
+  /**
+   * @brief Start a job after some time to related task queue,
+   * it can be delayed up to leeway to share the wake up with other timers
+  */
+  static timer_handle once_after(tq_wt related_tq, task_location loc, task_t job,
+    unsigned int delay_ms, duration_t leeway);
+
+  /**
+   * @brief Start a job after any delay to related task queue, e.g. std::chrono::microseconds(250)
+  */
+  static timer_handle once_after(tq_wt related_tq, task_location loc, task_t job, duration_t delay);
+  static timer_handle once_after(tq_wt related_tq, task_location loc, task_t job,
+    duration_t delay, duration_t leeway);
+  /**
+   * @brief Cancel an un-fired delay job, the job is destroied right away.
+   * Safe to call from any thread, a stale handle is ignored.
+  */
+  static void cancel_once(timer_handle handle);
+
+  /**
+   * @brief Post a job to the tail of the related queue at the time, the jobs of
+   * a queue come due in deadline order then posting order, see task_queue::post_at
+  */
+  static timer_handle post_at(tq_wt related_tq, task_location loc, task_t job, task_time_t time);
+
+  /**
+   * @brief Select the engine of all timers, pending jobs are moved to the new one.
+   * `tick` is the resolution of the wheel engine, ignored by the heap.
+  */
+  static void set_engine(timer_engine_type type, duration_t tick = std::chrono::milliseconds(1));
+
+  /**
+   * @brief Select how the timer thread sleeps, the default is k_timerfd on Linux.
+   * Return false if the backend is not supported on this platform.
+  */
+  static bool set_backend(timer_backend backend);
+
+  /**
+   * @brief On Linux the timer thread spins instead of sleeping when the next
+   * deadline is closer than the threshold, zero (the default) to never spin.
+   * Spinning trades a busy core for each timer shard, up to the threshold
+   * before every near deadline, for a lateness of a few microseconds.
+  */
+  static void set_spin_threshold(duration_t threshold);
+
+  /**
+   * @brief Count of the pending jobs of all timers
   */
-  static uint64_t once_after(tq_wt related_tq, task_location loc, task_t job, unsigned int delay_ms);
+  static size_t pending_count();
+
+  /**
+   * @brief Wait for every timer thread to fire the jobs due by the current
+   * time of the library clock, used by manual_clock::advance
+  */
+  static void sync_to_clock();
+
   /**
-   * @brief Cancel an un-fired delay job
+   * @brief Run timers on count shards (1 to 64), each one has its own thread and
+   * engine, new timers are assigned by the policy. Lowering the count only
+   * stops assigning new timers to the extra shards.
   */
-  static void cancel_once(uint64_t job_id);
+  static void set_shards(size_t count, timer_shard_policy policy = timer_shard_policy::k_by_queue);
 
 protected:
   /**
-   * @brief Timer status
+   * @brief The periodic job of the running timer
   */
-  std::shared_ptr<bool> status_;
+  timer_handle handle_;
   /**
    * @brief Related task queue
   */
   tq_wt related_tq_;
 };
 
+/**
+ * @brief Collapse repeated triggers into one run of the job on the related
+ * queue, when no trigger came for a window. Triggering does not allocate,
+ * at most one timer job is pending at a time.
+*/
+class debouncer {
+public:
+  debouncer(tq_wt related_tq, task_location loc, task_t job, duration_t window);
+  ~debouncer();
+
+  debouncer(const debouncer&) = delete;
+  debouncer(debouncer&&) = delete;
+  debouncer& operator =(const debouncer&) = delete;
+  debouncer& operator =(debouncer&&) = delete;
+
+  /**
+   * @brief Any thread, run the job a window later unless triggered again
+  */
+  void trigger();
+
+  /**
+   * @brief Drop the pending run, the next trigger starts a new window
+  */
+  void cancel();
+
+protected:
+  struct state;
+  std::shared_ptr<state> state_;
+};
+
+/**
+ * @brief Run the job on the related queue at most once per window. The first
+ * trigger runs it right away, the triggers within the window are collapsed
+ * into one run at the end of the window. Triggering does not allocate,
+ * at most one timer job is pending at a time.
+*/
+class throttler {
+public:
+  throttler(tq_wt related_tq, task_location loc, task_t job, duration_t window);
+  ~throttler();
+
+  throttler(const throttler&) = delete;
+  throttler(throttler&&) = delete;
+  throttler& operator =(const throttler&) = delete;
+  throttler& operator =(throttler&&) = delete;
+
+  /**
+   * @brief Any thread, run the job now or at the end of the current window
+  */
+  void trigger();
+
+  /**
+   * @brief Drop the run at the end of the current window
+  */
+  void cancel();
+
+protected:
+  struct state;
+  std::shared_ptr<state> state_;
+};
+
 } // namespace libtq
 
 #endif
@@ -0,0 +1,147 @@
+/*
+    task_trace_ring.h
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#ifndef LIBTQ_TASK_TRACE_RING_H__
+#define LIBTQ_TASK_TRACE_RING_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "task.h"
+
+#if defined(_WIN32)
+#pragma warning(disable: 4820)
+#pragma warning(disable: 5045)
+#endif
+
+namespace libtq {
+
+/**
+ * @brief Fixed capacity ring of the recent trace items, the oldest one is
+ * overwritten. One writer at a time, the writer role can move between threads
+ * when the hand over is synchronized by the caller. Readers take a snapshot
+ * without blocking the writer, each slot is guarded by its own sequence like
+ * a seqlock, a slot overwritten during the read is dropped from the snapshot.
+*/
+class trace_ring {
+public:
+  explicit trace_ring(size_t capacity) :
+    capacity_(capacity),
+    slots_(capacity > 0 ? new slot_t[capacity] : nullptr),
+    written_(0)
+  {
+  }
+
+  trace_ring(const trace_ring&) = delete;
+  trace_ring(trace_ring&&) = delete;
+  trace_ring& operator= (const trace_ring&) = delete;
+  trace_ring& operator= (trace_ring&&) = delete;
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  /**
+   * @brief Writer only, no lock and no allocation
+  */
+  void push(const task_trace_item& item) {
+    if (capacity_ == 0) {
+      return;
+    }
+    uint64_t n = written_.load(std::memory_order_relaxed);
+    slot_t& s = slots_[n % capacity_];
+    // odd while writing, readers of this slot retry or drop it
+    s.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.file.store(item.loc.file, std::memory_order_relaxed);
+    s.line.store(item.loc.line, std::memory_order_relaxed);
+    s.post_time.store(item.post_time.time_since_epoch().count(), std::memory_order_relaxed);
+    s.begin_time.store(item.begin_time.time_since_epoch().count(), std::memory_order_relaxed);
+    s.end_time.store(item.end_time.time_since_epoch().count(), std::memory_order_relaxed);
+    s.seq.store(2 * n + 2, std::memory_order_release);
+    written_.store(n + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Any thread, append the kept items to out, oldest first
+  */
+  template < typename _Out >
+  void snapshot(_Out& out) const {
+    uint64_t end = written_.load(std::memory_order_acquire);
+    uint64_t begin = (end > capacity_ ? end - capacity_ : 0);
+    for (uint64_t n = begin; n < end; ++n) {
+      const slot_t& s = slots_[n % capacity_];
+      uint64_t seq = s.seq.load(std::memory_order_acquire);
+      if (seq != 2 * n + 2) {
+        // being overwritten by a newer item
+        continue;
+      }
+      task_trace_item item;
+      item.loc.file = s.file.load(std::memory_order_relaxed);
+      item.loc.line = s.line.load(std::memory_order_relaxed);
+      item.post_time = task_time_t(task_time_t::duration(s.post_time.load(std::memory_order_relaxed)));
+      item.begin_time = task_time_t(task_time_t::duration(s.begin_time.load(std::memory_order_relaxed)));
+      item.end_time = task_time_t(task_time_t::duration(s.end_time.load(std::memory_order_relaxed)));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.seq.load(std::memory_order_relaxed) != seq) {
+        continue;
+      }
+      out.push(item);
+    }
+  }
+
+protected:
+  /**
+   * @brief Fields are relaxed atomics so a racing read is defined, the
+   * sequence tells if they are consistent
+  */
+  struct slot_t {
+    std::atomic<uint64_t>     seq{0};
+    std::atomic<const char*>  file{nullptr};
+    std::atomic<intptr_t>     line{0};
+    std::atomic<task_time_t::rep> post_time{0};
+    std::atomic<task_time_t::rep> begin_time{0};
+    std::atomic<task_time_t::rep> end_time{0};
+  };
+
+  size_t                      capacity_;
+  std::unique_ptr<slot_t[]>   slots_;
+  std::atomic<uint64_t>       written_;
+};
+
+} // namespace libtq
+
+#endif
+
+// Push Chen
@@ -30,17 +30,66 @@ SOFTWARE.
 */
 
 #include "task_worker.h"
+#include "task_queue.h"
+#include "task_clock.h"
 #include <chrono>
 
 namespace libtq {
 
+/**
+ * @brief The worker running in current thread
+*/
+static thread_local worker* t_current_worker = nullptr;
+
+/**
+ * @brief Check the shared queue after every N local tasks
+*/
+static const unsigned int k_shared_queue_check_interval = 61;
+
+/**
+ * @brief Read the clock for the run budget after every N tasks, when the
+ * tasks do not take timestamps
+*/
+static const unsigned int k_slice_check_interval = 8;
+
+/**
+ * @brief Check if the task takes the begin and end time
+*/
+static bool takes_timestamps_(const task& t) {
+#if LIBTQ_TRACE_LEVEL >= 2
+  return !t.owner || t.owner->has_timestamps();
+#else
+  (void)t;
+  return false;
+#endif
+}
+
 /**
  * @brief Init a worker with the task queue.
  * @remarks throw runtime error when the queue is not validate
 */
 worker::worker(eq_wt q, thread_attribute attr) : 
   thread(attr),
-  related_eq_(q)
+  related_eq_(q),
+  domain_(nullptr),
+  slot_(0),
+  running_eq_(nullptr),
+  local_tick_(0),
+  steal_seed_(0)
+{
+}
+
+/**
+ * @brief Init a work stealing worker owning the slot in the domain
+*/
+worker::worker(eq_wt q, thread_attribute attr, ws_domain* domain, size_t slot) :
+  thread(attr),
+  related_eq_(q),
+  domain_(domain),
+  slot_(slot),
+  running_eq_(nullptr),
+  local_tick_(0),
+  steal_seed_((uint32_t)slot * 2654435761u + 1u)
 {
 }
 
@@ -49,47 +98,220 @@ worker::worker(eq_wt q, thread_attribute attr) :
 */
 worker::~worker() {
   this->stop();
+  if (domain_ != nullptr) {
+    domain_->used[slot_].store(false, std::memory_order_release);
+  }
 }
 
 void worker::main() {
   std::lock_guard<std::mutex> running_guard(this->running_lock_);
+  t_current_worker = this;
   // start signal
   this->started_();
 
+  if (domain_ != nullptr) {
+    this->main_work_stealing_();
+  } else {
+    this->main_shared_();
+  }
+  t_current_worker = nullptr;
+}
+
+void worker::main_shared_() {
+  bool registered = false;
   while (this->is_validate()) {
     auto sq = related_eq_.lock();
     if (!sq) {
-      break;
+      // the queue has gone together with the registration
+      return;
+    }
+    if (!registered) {
+      sq->register_waiter(waiter_);
+      registered = true;
     }
-    auto st = sq->wait((size_t)this->current_priority(), [this]() { return !this->is_validate(); });
+    auto st = sq->wait(waiter_, (size_t)this->current_priority(), [this]() { return !this->is_validate(); });
     if (!st) {
       continue;
     }
-    // this is normal state
-    if (this->current_priority() == this->configed_priority()) {
-      if ((int)this->current_priority() < st->prio) {
-        // upgrade the thread priority
-        this->change_priority((thread_priority)st->prio);
-        this->adjust_prio_time_ = std::chrono::steady_clock::now();
-      } // else do nothing, we don't need to downgrade the thread priority
-        // to run the lower priority job
-    } else {
-      if (st->prio <= (size_t)this->configed_priority()) {
-        // Overclocking the thread priority for at least 30 seconds
-        auto kept_duration = std::chrono::duration_cast<std::chrono::seconds>(
-          std::chrono::steady_clock::now() - this->adjust_prio_time_).count();
-        if (kept_duration > 30) {
-          this->change_priority(this->configed_priority());
-        }
+    this->run_(*sq, *st);
+  }
+  if (!registered) {
+    return;
+  }
+  if (auto sq = related_eq_.lock()) {
+    sq->unregister_waiter(waiter_);
+  }
+}
+
+void worker::main_work_stealing_() {
+  // The local deque holds items of the event queue, keep it alive until
+  // all of them are given back.
+  auto sq = related_eq_.lock();
+  if (!sq) {
+    return;
+  }
+  running_eq_ = sq.get();
+  sq->register_waiter(waiter_);
+  while (this->is_validate()) {
+    auto st = this->take_local_(*sq);
+    if (!st) {
+      // checked under the lock of the queue before parking, an item pushed to
+      // a local deque after take_local_ found nothing is not missed
+      st = sq->wait(waiter_, (size_t)this->current_priority(), [this, &sq]() {
+        return !this->is_validate() || sq->local_pending() > 0;
+      });
+    }
+    if (!st) {
+      continue;
+    }
+    this->run_(*sq, *st);
+  }
+  sq->unregister_waiter(waiter_);
+  running_eq_ = nullptr;
+  // Move the rest local tasks back to the shared queue
+  eq_t::item_wrapper* item = nullptr;
+  while (domain_->deques[slot_].pop(item)) {
+    sq->remove_local_pending();
+    sq->emplace_back(sq->adopt_item(item));
+  }
+}
+
+eq_t::item_strong_t worker::take_local_(eq_t& eq) {
+  auto& local = domain_->deques[slot_];
+  auto prio = (size_t)this->current_priority();
+  // Do not starve the shared queue
+  if (++local_tick_ % k_shared_queue_check_interval == 0) {
+    if (auto st = eq.try_pick(prio)) {
+      return st;
+    }
+  }
+  eq_t::item_wrapper* item = nullptr;
+  if (local.pop(item)) {
+    // Higher priority task is waiting in the shared queue
+    if (eq.has_pending_above(item->prio)) {
+      if (auto st = eq.try_pick(prio)) {
+        // still counted, the pop is not uncounted
+        local.push(item);
+        return st;
+      }
+    }
+    eq.remove_local_pending();
+    return eq.adopt_item(item);
+  }
+  // Steal from a random victim
+  steal_seed_ ^= steal_seed_ << 13;
+  steal_seed_ ^= steal_seed_ >> 17;
+  steal_seed_ ^= steal_seed_ << 5;
+  size_t begin = steal_seed_ % ws_domain::k_max_workers;
+  for (size_t i = 0; i < ws_domain::k_max_workers; ++i) {
+    size_t victim = (begin + i) % ws_domain::k_max_workers;
+    if (victim == slot_ || !domain_->used[victim].load(std::memory_order_acquire)) {
+      continue;
+    }
+    if (domain_->deques[victim].steal(item)) {
+      if (eq.remove_local_pending() > 1) {
+        // more to steal, pass the nudge on to another idle worker
+        eq.wake_waiter();
+      }
+      return eq.adopt_item(item);
+    }
+  }
+  return nullptr;
+}
+
+void worker::run_(eq_t& eq, eq_t::item_wrapper& st) {
+  // this is normal state
+  if (this->current_priority() == this->configed_priority()) {
+    if ((size_t)this->current_priority() < st.prio) {
+      // upgrade the thread priority
+      this->change_priority((thread_priority)st.prio);
+      this->adjust_prio_time_ = task_now();
+    } // else do nothing, we don't need to downgrade the thread priority
+      // to run the lower priority job
+  } else {
+    if (st.prio <= (size_t)this->configed_priority()) {
+      // Overclocking the thread priority for at least 30 seconds
+      auto kept_duration = std::chrono::duration_cast<std::chrono::seconds>(
+        task_now() - this->adjust_prio_time_).count();
+      if (kept_duration > 30) {
+        this->change_priority(this->configed_priority());
+      }
+    }
+  }
+  bool stamp = takes_timestamps_(st.i);
+  // without the timestamps, the run budget reads the clock itself
+  task_time_t run_begin = (stamp || !st.i.owner ? task_time_t() : task_now());
+  this->invoke_(st.i, stamp);
+  if (!st.i.owner) {
+    return;
+  }
+  // Advance the serial queue the task belongs to, keep running it in this worker
+  // till the budget is used up or a higher priority task is waiting
+  unsigned int budget_count = st.i.owner->run_budget_count.load(std::memory_order_relaxed);
+  auto slice_end = (stamp ? st.i.begin_time : run_begin) + st.i.owner->run_budget_slice.load(std::memory_order_relaxed);
+  task_time_t last_end = (stamp ? st.i.end_time : run_begin);
+  for (unsigned int ran = 1; ; ++ran) {
+    bool keep_running = (
+      ran < budget_count && last_end < slice_end &&
+      !eq.has_pending_above(st.prio) && this->is_validate()
+    );
+    if (!task_queue_impl::task_done(st.i, keep_running)) {
+      break;
+    }
+    stamp = takes_timestamps_(st.i);
+    this->invoke_(st.i, stamp);
+    if (stamp) {
+      last_end = st.i.end_time;
+    } else if (ran % k_slice_check_interval == 0) {
+      last_end = task_now();
+    }
+  }
+}
+
+void worker::invoke_(task& t, bool stamp) {
+  if (stamp) {
+    t.begin_time = task_now();
+  } else {
+    // no stale time from the last task of the node
+    t.begin_time = task_time_t();
+    t.end_time = task_time_t();
+  }
+  // invoke the task
+  if (t.before) t.before(&t);
+  if (t.t) t.t();
+  if (stamp) {
+    t.end_time = task_now();
+  }
+  if (t.after) t.after(&t);
+}
+
+/**
+ * @brief Post a task to the event queue. When called from a work stealing worker
+ * of the same event queue, the task goes to the worker's local deque first.
+*/
+void worker::dispatch(eq_t& eq, task&& t, size_t priority) {
+  worker* w = t_current_worker;
+  if (
+    w != nullptr && w->running_eq_ == &eq && 
+    priority > 0 && priority <= (size_t)w->configed_priority()
+  ) {
+    auto item = eq.make_item(std::move(t), priority);
+    // counted before the push, so a thief never uncounts an item not counted yet
+    size_t before = eq.add_local_pending();
+    if (w->domain_->deques[w->slot_].push(item.get())) {
+      item.release();
+      // Let an idle worker come to steal, when there was no local work. Otherwise
+      // a worker is already nudged, and a parking one sees the count
+      if (before == 0) {
+        eq.wake_waiter();
       }
+      return;
     }
-    st->i.begin_time = std::chrono::steady_clock::now();
-    // invoke the task
-    if (st->i.before) st->i.before(&st->i);
-    if (st->i.t) st->i.t();
-    st->i.end_time = std::chrono::steady_clock::now();
-    if (st->i.after) st->i.after(&st->i);
+    eq.remove_local_pending();
+    eq.emplace_back(std::move(item));
+    return;
   }
+  eq.emplace_back(std::move(t), priority);
 }
 
 /**
@@ -99,7 +321,7 @@ void worker::stop() {
   if (this->is_validate()) {
     this->invalidate_();
     if (auto sq = related_eq_.lock()) {
-      sq->break_waiter(this->id());
+      sq->break_waiter(waiter_);
     }
   }
   // wait until get the running lock
@@ -40,6 +40,7 @@ SOFTWARE.
 #include <memory>
 #include "task.h"
 #include "task_event_queue.h"
+#include "task_ws_deque.h"
 #include "task_thread.h"
 
 namespace libtq {
@@ -48,6 +49,34 @@ typedef event_queue<task> eq_t;
 typedef std::weak_ptr<eq_t> eq_wt;
 typedef std::shared_ptr<eq_t> eq_st;
 
+/**
+ * @brief How the workers in a group get their tasks
+*/
+enum class schedule_mode {
+  k_shared_queue,     // all workers pick up from the shared event queue
+  k_work_stealing     // local deque first, then steal from other workers, then the shared queue
+};
+
+typedef ws_deque<eq_t::item_wrapper*, 256> local_deque_t;
+
+/**
+ * @brief Local deques of all workers in a work stealing worker group,
+ * each worker owns one slot
+*/
+struct ws_domain {
+  enum { k_max_workers = 64 };
+  std::array<local_deque_t, k_max_workers>      deques;
+  std::array<std::atomic<bool>, k_max_workers>  used;
+
+  ws_domain() {
+    for (auto& u : used) {
+      u.store(false, std::memory_order_relaxed);
+    }
+  }
+  LIBTQ_DISABLE_COPY(ws_domain)
+  LIBTQ_DISABLE_MOVE(ws_domain)
+};
+
 class worker : public thread {
 public:
   /**
@@ -56,6 +85,11 @@ public:
   */
   worker(eq_wt q, thread_attribute attr);
 
+  /**
+   * @brief Init a work stealing worker owning the slot in the domain
+  */
+  worker(eq_wt q, thread_attribute attr, ws_domain* domain, size_t slot);
+
   /**
    * @brief Stop and quit worker
   */
@@ -73,12 +107,44 @@ public:
   */
   void stop();
 
+  /**
+   * @brief Post a task to the event queue. When called from a work stealing worker
+   * of the same event queue, the task goes to the worker's local deque first.
+  */
+  static void dispatch(eq_t& eq, task&& t, size_t priority);
+
 protected:
   /**
    * @brief inner thread main function
   */
   virtual void main();
 
+  /**
+   * @brief Only pick up from the shared event queue
+  */
+  void main_shared_();
+
+  /**
+   * @brief Local deque, stealing, then the shared event queue
+  */
+  void main_work_stealing_();
+
+  /**
+   * @brief Get a task from local deque or other workers without blocking
+  */
+  eq_t::item_strong_t take_local_(eq_t& eq);
+
+  /**
+   * @brief Adjust the thread priority and invoke the task, then keep running
+   * the following tasks of its serial queue within the run budget
+  */
+  void run_(eq_t& eq, eq_t::item_wrapper& st);
+
+  /**
+   * @brief Invoke the task and its hooks, take the begin and end time if stamp
+  */
+  void invoke_(task& t, bool stamp);
+
 private:
   /**
    * @brief running status lock
@@ -89,10 +155,29 @@ private:
    * @brief Releated event queue
   */
   eq_wt related_eq_;
+  /**
+   * @brief Parking slot in the event queue, registered once when the worker starts
+  */
+  eq_t::waiter waiter_;
   /**
    * @brief Last change priority time
   */
   task_time_t adjust_prio_time_;
+
+  /**
+   * @brief Work stealing domain and the slot of local deque, null for shared queue mode
+  */
+  ws_domain* domain_;
+  size_t slot_;
+  /**
+   * @brief The event queue the worker is running on, only set in work stealing mode
+  */
+  eq_t* running_eq_;
+  /**
+   * @brief Local task count, to check the shared queue periodically
+  */
+  unsigned int local_tick_;
+  uint32_t steal_seed_;
 };
 
 } // namespace libtq
@@ -37,7 +37,8 @@ namespace libtq {
 /**
  * @brief Create a worker group with default 2 workers
 */
-worker_group::worker_group(eq_wt q, unsigned int worker_count, thread_priority base_prio) : 
+worker_group::worker_group(eq_wt q, unsigned int worker_count, thread_priority base_prio, schedule_mode mode) : 
+  ws_domain_(mode == schedule_mode::k_work_stealing ? new ws_domain : nullptr),
   related_eq_(q), base_priority_(base_prio)
 {
   for (unsigned int i = 0; i < worker_count; ++i) {
@@ -73,6 +74,13 @@ size_t worker_group::size(thread_priority priority) const {
   return ret;
 }
 
+/**
+ * @brief Get the schedule mode of the group
+*/
+schedule_mode worker_group::mode() const {
+  return (ws_domain_ ? schedule_mode::k_work_stealing : schedule_mode::k_shared_queue);
+}
+
 /**
  * @brief Check if current thread is in the worker group
 */
@@ -91,8 +99,8 @@ bool worker_group::in_worker_group() const {
  * @brief increase a worker
 */
 void worker_group::increase_worker() {
-  w_st w = std::make_shared<worker>(this->related_eq_, make_thread_attribute_with_priority(base_priority_));
   std::lock_guard<std::mutex> _(this->worker_lock_);
+  w_st w = this->create_worker_(base_priority_);
   this->workers_.push_back(w);
   w->start();
 }
@@ -100,8 +108,8 @@ void worker_group::increase_worker() {
  * @brief increate a worker with specifial priority
 */
 void worker_group::increase_worker(thread_priority priority) {
-  w_st w = std::make_shared<worker>(this->related_eq_, make_thread_attribute_with_priority(priority));
   std::lock_guard<std::mutex> _(this->worker_lock_);
+  w_st w = this->create_worker_(priority);
   this->workers_.push_back(w);
   w->start();
 }
@@ -133,6 +141,24 @@ void worker_group::decrease_worker(thread_priority priority) {
   this->workers_.erase(w_it);
 }
 
+/**
+ * @brief Create a worker, bind to a free local deque in work stealing mode.
+ * Lock must be held.
+*/
+w_st worker_group::create_worker_(thread_priority priority) {
+  auto attr = make_thread_attribute_with_priority(priority);
+  if (ws_domain_) {
+    for (size_t slot = 0; slot < ws_domain::k_max_workers; ++slot) {
+      bool expected = false;
+      if (ws_domain_->used[slot].compare_exchange_strong(expected, true)) {
+        return std::make_shared<worker>(this->related_eq_, attr, ws_domain_.get(), slot);
+      }
+    }
+    // Out of local deques, the worker only works on the shared queue
+  }
+  return std::make_shared<worker>(this->related_eq_, attr);
+}
+
 } // namespace libtq
 
 // Push Chen
@@ -46,7 +46,9 @@ public:
   /**
    * @brief Create a worker group with default 2 workers
   */
-  worker_group(eq_wt q, unsigned int worker_count = 2, thread_priority base_prio = thread_priority::k_normal);
+  worker_group(eq_wt q, unsigned int worker_count = 2, 
+    thread_priority base_prio = thread_priority::k_normal,
+    schedule_mode mode = schedule_mode::k_shared_queue);
 
   /**
    * @brief Destroy the group
@@ -63,6 +65,11 @@ public:
   */
   size_t size(thread_priority priority) const;
 
+  /**
+   * @brief Get the schedule mode of the group
+  */
+  schedule_mode mode() const;
+
   /**
    * @brief Check if current thread is in the worker group
   */
@@ -95,6 +102,18 @@ public:
   worker_group& operator =(worker_group&&) = delete;
 
 protected:
+  /**
+   * @brief Create a worker, bind to a free local deque in work stealing mode.
+   * Lock must be held.
+  */
+  w_st create_worker_(thread_priority priority);
+
+protected:
+  /**
+   * @brief Local deques for work stealing mode, must be destroyed after all workers
+  */
+  std::unique_ptr<ws_domain> ws_domain_;
+
   /**
    * @brief Worker storage
   */
@@ -0,0 +1,139 @@
+/*
+    task_ws_deque.h
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#ifndef LIBTQ_TASK_WS_DEQUE_H__
+#define LIBTQ_TASK_WS_DEQUE_H__
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+
+#if defined(_WIN32)
+#pragma warning(disable: 4820)
+#pragma warning(disable: 5045)
+#endif
+
+namespace libtq {
+
+/**
+ * @brief Fixed size Chase-Lev work stealing deque.
+ * The owner thread pushes and pops at the bottom (LIFO), other threads
+ * steal from the top (FIFO).
+ * @param _Ty: must be trivially copyable, usually a pointer
+ * @param capacity: must be the power of 2
+*/
+template < typename _Ty, size_t capacity = 1024 >
+class ws_deque {
+  static_assert((capacity & (capacity - 1)) == 0, "capacity should be the power of 2");
+public:
+  ws_deque() : top_(0), bottom_(0) {}
+  ws_deque(const ws_deque&) = delete;
+  ws_deque(ws_deque&&) = delete;
+  ws_deque& operator= (const ws_deque&) = delete;
+  ws_deque& operator= (ws_deque&&) = delete;
+
+  /**
+   * @brief Owner only, push to the bottom, return false when the deque is full
+  */
+  bool push(_Ty v) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    if (b - t >= (int64_t)capacity) {
+      return false;
+    }
+    buf_[(size_t)b & (capacity - 1)].store(v, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * @brief Owner only, pop the latest pushed item
+  */
+  bool pop(_Ty& v) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      // empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    v = buf_[(size_t)b & (capacity - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+      // the last one, race with the thieves
+      bool won = top_.compare_exchange_strong(t, t + 1, 
+        std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Any thread, steal the oldest item
+  */
+  bool steal(_Ty& v) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    v = buf_[(size_t)t & (capacity - 1)].load(std::memory_order_relaxed);
+    return top_.compare_exchange_strong(t, t + 1, 
+      std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Item count, only a hint for other threads
+  */
+  size_t size_approx() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return (b > t ? (size_t)(b - t) : 0);
+  }
+
+protected:
+  std::atomic<int64_t>                    top_;
+  char                                    pad_[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t>                    bottom_;
+  std::array<std::atomic<_Ty>, capacity>  buf_;
+};
+
+} // namespace libtq
+
+#endif
+
+// Push Chen
@@ -33,6 +33,25 @@ SOFTWARE.
 #include "task_event_queue.h"
 #include "task.h"
 
+#include <new>
+#include <cstdlib>
+
+// Count the allocations made by current thread
+static thread_local size_t t_alloc_count = 0;
+
+void* operator new(size_t size) {
+  ++t_alloc_count;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
 class event_queue_test : public testing::Test {
 public:
   event_queue_test() = default;
@@ -105,7 +124,7 @@ TEST_F(event_queue_test, emplace_order) {
   std::vector< libtq::event_queue<std::string>::item_strong_t > data;
   for (int i = 0; i < 4; ++i) {
     auto result = this->test_eq_.wait();
-    data.push_back(result);
+    data.push_back(std::move(result));
   }
   std::vector<std::string> expect_data = {"4", "3", "1", "2"};
   for (size_t i = 0; i < 4; ++i) {
@@ -123,4 +142,137 @@ TEST_F(event_queue_test, destroy) {
   auto result = eq->wait();
   EXPECT_FALSE(result);
   if (t.joinable()) t.join();
-}
\ No newline at end of file
+}
+TEST_F(event_queue_test, wake_one_waiter_by_priority) {
+  std::atomic<int> low_got(0);
+  std::atomic<int> high_got(0);
+  std::thread low([this, &low_got]() {
+    if (this->test_eq_.wait(2)) ++low_got;
+  });
+  std::thread high([this, &high_got]() {
+    if (this->test_eq_.wait(5)) ++high_got;
+  });
+  while (this->test_eq_.waiter_count() != 2) {
+    std::this_thread::yield();
+  }
+  // Only the high priority waiter should be woken up for a high priority item
+  this->test_eq_.emplace_back("high", 5);
+  high.join();
+  EXPECT_EQ(high_got, 1);
+  EXPECT_EQ(low_got, 0);
+  EXPECT_EQ(this->test_eq_.waiter_count(), 1);
+
+  this->test_eq_.emplace_back("low", 2);
+  low.join();
+  EXPECT_EQ(low_got, 1);
+  EXPECT_EQ(this->test_eq_.waiter_count(), 0);
+}
+
+TEST(event_queue_lanes_test, pick_across_64_lanes) {
+  libtq::event_queue<int, 64, 32> eq;
+  for (int p = 1; p <= 64; ++p) {
+    eq.emplace_back(std::move(p), (size_t)p);
+  }
+  // No higher waiter, always take the highest lane first
+  for (int p = 64; p >= 1; --p) {
+    auto r = eq.try_pick(1);
+    ASSERT_TRUE(r);
+    EXPECT_EQ(r->i, p);
+  }
+  EXPECT_EQ(eq.pending_count(), 0u);
+  EXPECT_FALSE(eq.has_pending_above(0));
+}
+
+TEST(event_queue_lanes_test, registered_waiter_slot) {
+  libtq::event_queue<int, 32, 16> eq;
+  std::atomic<int> got(0);
+  std::atomic<bool> stop(false);
+  std::thread t([&eq, &got, &stop]() {
+    libtq::event_queue<int, 32, 16>::waiter w;
+    eq.register_waiter(w);
+    while (!stop) {
+      if (auto r = eq.wait(w, 32, [&stop]() { return stop.load(); })) {
+        got += r->i;
+      }
+    }
+    eq.unregister_waiter(w);
+  });
+  for (int i = 1; i <= 100; ++i) {
+    eq.emplace_back(1, (size_t)(i % 32 + 1));
+  }
+  while (got != 100) {
+    std::this_thread::yield();
+  }
+  stop = true;
+  eq.break_waiter(t.get_id());
+  t.join();
+  EXPECT_EQ(eq.waiter_count(), 0u);
+}
+
+TEST(event_queue_pool_test, no_allocation_in_steady_state) {
+  libtq::event_queue<int> eq;
+  // warm up the node pool
+  for (int i = 0; i < 100; ++i) {
+    eq.emplace_back(std::move(i));
+  }
+  while (eq.try_pick()) {}
+  size_t capacity = eq.pool_capacity();
+
+  size_t before = t_alloc_count;
+  for (int round = 0; round < 1000; ++round) {
+    for (int i = 0; i < 50; ++i) {
+      eq.emplace_back(std::move(i), (size_t)(i % 5 + 1));
+    }
+    eq.emplace_front(-1);
+    for (int i = 0; i < 51; ++i) {
+      EXPECT_TRUE(eq.try_pick(5));
+    }
+  }
+  EXPECT_EQ(t_alloc_count - before, 0u);
+  EXPECT_EQ(eq.pool_capacity(), capacity);
+  EXPECT_EQ(eq.pending_count(), 0u);
+}
+
+TEST(event_queue_pool_test, stale_handle_cancel) {
+  libtq::event_queue<int> eq;
+  auto h = eq.emplace_back(1);
+  EXPECT_TRUE(eq.try_pick());
+  // keep posting until the node is reused, the old handle must not cancel it
+  libtq::event_queue<int>::item_handle h2;
+  for (int i = 0; i < 1000 && h2.node != h.node; ++i) {
+    h2 = eq.emplace_back(2);
+    if (h2.node != h.node) {
+      EXPECT_TRUE(eq.try_pick());
+    }
+  }
+  ASSERT_EQ(h.node, h2.node);
+  eq.cancel(h);
+  EXPECT_EQ(eq.pending_count(), 1u);
+  eq.cancel(h2);
+  EXPECT_EQ(eq.pending_count(), 0u);
+  eq.cancel(h2);
+  EXPECT_FALSE(eq.try_pick());
+}
+
+TEST(event_queue_bulk_test, emplace_back_bulk) {
+  libtq::event_queue<int> eq;
+  std::atomic<int> got(0);
+  std::vector<std::thread> waiters;
+  for (int i = 0; i < 4; ++i) {
+    waiters.emplace_back([&eq, &got]() {
+      if (eq.wait()) ++got;
+    });
+  }
+  while (eq.waiter_count() != 4) {
+    std::this_thread::yield();
+  }
+  std::vector<int> items = {1, 2, 3, 4, 5, 6};
+  // all idle waiters are woken up by one bulk post
+  EXPECT_EQ(eq.emplace_back_bulk(items.begin(), items.end()), 6u);
+  for (auto& t : waiters) t.join();
+  EXPECT_EQ(got, 4);
+  EXPECT_EQ(eq.pending_count(), 2u);
+  auto r = eq.try_pick();
+  ASSERT_TRUE(r);
+  EXPECT_EQ(r->i, 5);
+}
@@ -0,0 +1,96 @@
+/*
+    function_unittest.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "gtest/gtest.h"
+#include "task_function.h"
+
+#include <array>
+#include <memory>
+#include <string>
+
+TEST(unique_function_test, move_only_capture) {
+  std::unique_ptr<int> v(new int(42));
+  int got = 0;
+  libtq::unique_task t = [v = std::move(v), &got]() { got = *v; };
+  EXPECT_TRUE(t);
+  EXPECT_TRUE(t.is_inline());
+  libtq::unique_task t2 = std::move(t);
+  EXPECT_FALSE(t);
+  t2();
+  EXPECT_EQ(got, 42);
+}
+
+TEST(unique_function_test, large_capture_on_heap) {
+  std::array<char, LIBTQ_TASK_INLINE_SIZE + 8> big;
+  big.fill('x');
+  char got = 0;
+  libtq::unique_task t = [big, &got]() { got = big[LIBTQ_TASK_INLINE_SIZE]; };
+  EXPECT_FALSE(t.is_inline());
+  libtq::unique_task t2;
+  t2 = std::move(t);
+  t2();
+  EXPECT_EQ(got, 'x');
+}
+
+TEST(unique_function_test, destroy_once) {
+  auto counter = std::make_shared<int>(0);
+  {
+    libtq::unique_task t = [counter]() {};
+    EXPECT_EQ(counter.use_count(), 2);
+    libtq::unique_task t2 = std::move(t);
+    libtq::unique_task t3 = std::move(t2);
+    EXPECT_EQ(counter.use_count(), 2);
+    t3 = nullptr;
+    EXPECT_EQ(counter.use_count(), 1);
+  }
+  EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(unique_function_test, empty_sources) {
+  std::function<void()> empty;
+  libtq::unique_task t1 = empty;
+  EXPECT_FALSE(t1);
+  void (*fp)() = nullptr;
+  libtq::unique_task t2 = fp;
+  EXPECT_FALSE(t2);
+  libtq::unique_task t3 = nullptr;
+  EXPECT_TRUE(t3 == nullptr);
+}
+
+TEST(unique_function_test, arguments_and_result) {
+  libtq::unique_function<std::string(const std::string&, int)> f = 
+    [](const std::string& s, int n) {
+      std::string r;
+      for (int i = 0; i < n; ++i) r += s;
+      return r;
+    };
+  EXPECT_EQ(f("ab", 3), "ababab");
+}
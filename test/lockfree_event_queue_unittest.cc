@@ -0,0 +1,178 @@
+/*
+    lockfree_event_queue_unittest.cc
+    libtq
+    2026-10-16
+    Push Chen
+*/
+
+/*
+MIT License
+
+Copyright (c) 2026 Push Chen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "gtest/gtest.h"
+#include "task_lockfree_event_queue.h"
+#include "task.h"
+
+#include <vector>
+#include <string>
+#include <atomic>
+
+class lockfree_event_queue_test : public testing::Test {
+public:
+  lockfree_event_queue_test() : test_eq_(16) {}
+protected:
+  LIBTQ_DISABLE_COPY(lockfree_event_queue_test)
+  LIBTQ_DISABLE_MOVE(lockfree_event_queue_test)
+protected:
+  libtq::lockfree_event_queue<std::string> test_eq_;
+};
+
+TEST_F(lockfree_event_queue_test, infinitive_wait_base) {
+  std::thread t([this]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    this->test_eq_.emplace_back("hellotq");
+  });
+  auto result = test_eq_.wait();
+  EXPECT_TRUE(result);
+  EXPECT_EQ(result->i, "hellotq");
+  t.join();
+}
+
+TEST_F(lockfree_event_queue_test, infinitive_wait_break) {
+  std::thread::id tid = std::this_thread::get_id();
+  std::atomic<bool> done{false};
+  std::thread t([this, tid, &done]() {
+    // a break lands only once the thread is inside the wait
+    while (!done) {
+      this->test_eq_.break_waiter(tid);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  auto result = test_eq_.wait();
+  EXPECT_FALSE(result);
+  done = true;
+  t.join();
+}
+
+TEST_F(lockfree_event_queue_test, break_before_wait) {
+  // the thread is not waiting, the break is dropped
+  this->test_eq_.break_waiter(std::this_thread::get_id());
+  auto begin = std::chrono::steady_clock::now();
+  auto result = this->test_eq_.wait_for(std::chrono::milliseconds(10));
+  EXPECT_FALSE(result);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(10));
+  // a break on a slot is sticky, the next wait returns right away
+  decltype(this->test_eq_)::waiter w;
+  this->test_eq_.register_waiter(w);
+  this->test_eq_.break_waiter(w);
+  result = this->test_eq_.wait(w);
+  EXPECT_FALSE(result);
+  // the break is consumed, this one times out
+  begin = std::chrono::steady_clock::now();
+  result = this->test_eq_.wait_for(std::chrono::milliseconds(10), w);
+  EXPECT_FALSE(result);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(10));
+  this->test_eq_.emplace_back("hellotq");
+  result = this->test_eq_.wait(w);
+  ASSERT_TRUE(result);
+  EXPECT_EQ(result->i, "hellotq");
+  this->test_eq_.unregister_waiter(w);
+}
+
+TEST_F(lockfree_event_queue_test, wait_for_timeout) {
+  auto result = this->test_eq_.wait_for(std::chrono::milliseconds(30));
+  EXPECT_FALSE(result);
+}
+
+TEST_F(lockfree_event_queue_test, bounded_capacity) {
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_TRUE(this->test_eq_.emplace_back(std::to_string(i)));
+  }
+  EXPECT_FALSE(this->test_eq_.emplace_back("full"));
+  EXPECT_EQ(this->test_eq_.pending_count(), 16);
+  {
+    auto result = this->test_eq_.wait();
+    EXPECT_TRUE(result);
+    EXPECT_EQ(result->i, "0");
+    // the node is still in use
+    EXPECT_FALSE(this->test_eq_.emplace_back("full"));
+  }
+  EXPECT_TRUE(this->test_eq_.emplace_back("16"));
+  this->test_eq_.cancel_all();
+  EXPECT_EQ(this->test_eq_.pending_count(), 0);
+}
+
+TEST_F(lockfree_event_queue_test, pick_higher_priority_first) {
+  this->test_eq_.emplace_back("low", 1);
+  this->test_eq_.emplace_back("normal", 2);
+  this->test_eq_.emplace_back("high", 5);
+  std::vector<std::string> expect_data = {"high", "normal", "low"};
+  for (size_t i = 0; i < expect_data.size(); ++i) {
+    auto result = this->test_eq_.wait(2);
+    EXPECT_TRUE(result);
+    EXPECT_EQ(result->i, expect_data[i]);
+  }
+}
+
+TEST(lockfree_event_queue_mpmc_test, all_items_delivered) {
+  const int producer_count = 4;
+  const int consumer_count = 4;
+  const int item_count = 20000;
+  libtq::lockfree_event_queue<int> eq(256);
+  std::atomic<long long> sum(0);
+  std::atomic<int> received(0);
+  std::vector<std::thread> threads;
+  for (int c = 0; c < consumer_count; ++c) {
+    threads.emplace_back([&eq, &sum, &received]() {
+      while (auto r = eq.wait()) {
+        if (r->i < 0) break;
+        sum += r->i;
+        ++received;
+      }
+    });
+  }
+  for (int p = 0; p < producer_count; ++p) {
+    threads.emplace_back([&eq]() {
+      for (int i = 1; i <= item_count; ++i) {
+        int v = i;
+        while (!eq.emplace_back(std::move(v))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int p = 0; p < producer_count; ++p) {
+    threads[consumer_count + p].join();
+  }
+  for (int c = 0; c < consumer_count; ++c) {
+    int v = -1;
+    while (!eq.emplace_back(std::move(v))) {
+      std::this_thread::yield();
+    }
+  }
+  for (int c = 0; c < consumer_count; ++c) {
+    threads[c].join();
+  }
+  EXPECT_EQ(received, producer_count * item_count);
+  EXPECT_EQ(sum, (long long)producer_count * item_count * (item_count + 1) / 2);
+}
@@ -30,8 +30,13 @@ SOFTWARE.
 */
 
 #include "task_queue.h"
+#include "task_clock.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <string>
+#include <thread>
+
 class task_queue_test : public testing::Test {
 public:
   task_queue_test() : 
@@ -124,3 +129,291 @@ TEST_F(task_queue_test, break_queue) {
   std::this_thread::sleep_for(std::chrono::milliseconds(50));
   EXPECT_EQ(result.size(), 3);
 }
+
+TEST_F(task_queue_test, post_to_head_while_running) {
+  std::vector<int> result;
+  std::mutex rlock;
+  auto push = [&result, &rlock](int v) {
+    std::lock_guard<std::mutex> _(rlock);
+    result.push_back(v);
+  };
+  tq_->post_task(__TQ_TASK_LOC, [push]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    push(0);
+  });
+  tq_->post_task(__TQ_TASK_LOC, [push]() { push(2); });
+  // the first task has been handed to the workers, go right after it
+  tq_->post_task(__TQ_TASK_LOC, [push]() { push(1); }, 1);
+  tq_->sync_task(__TQ_TASK_LOC, [push]() { push(3); });
+  std::vector<int> expect_result = {0, 1, 2, 3};
+  EXPECT_EQ(result, expect_result);
+}
+
+TEST_F(task_queue_test, post_tasks_in_batch) {
+  std::vector<int> result;
+  libtq::task_batch_t batch;
+  for (int i = 0; i < 100; ++i) {
+    batch.push_back({libtq::task_location{"batch", i}, [&result, i]() {
+      result.push_back(i);
+    }});
+  }
+  tq_->post_tasks(std::move(batch));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  ASSERT_EQ(result.size(), 100u);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(result[i], i);
+  }
+#if LIBTQ_TRACE_LEVEL >= 1
+  auto traces = tq_->recent_trace_info();
+  ASSERT_EQ(traces.size(), 100u);
+  EXPECT_STREQ(traces.front().loc.file, "batch");
+  EXPECT_EQ(traces.front().loc.line, 1);
+#endif
+}
+
+TEST_F(task_queue_test, post_delayed_in_deadline_order) {
+  std::vector<int> result;
+  std::mutex rlock;
+  auto push = [&result, &rlock](int v) {
+    return [&result, &rlock, v]() {
+      std::lock_guard<std::mutex> _(rlock);
+      result.push_back(v);
+    };
+  };
+  auto at = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+  tq_->post_at(__TQ_TASK_LOC, push(2), at);
+  tq_->post_at(__TQ_TASK_LOC, push(3), at);
+  auto h = tq_->post_at(__TQ_TASK_LOC, push(100), at);
+  tq_->post_at(__TQ_TASK_LOC, push(4), at + std::chrono::milliseconds(5));
+  tq_->post_delayed(__TQ_TASK_LOC, push(1), std::chrono::milliseconds(5));
+  EXPECT_TRUE((bool)h);
+  tq_->cancel_delayed(h);
+  // cancel again is a no-op
+  tq_->cancel_delayed(h);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  std::vector<int> expect_result = {1, 2, 3, 4};
+  EXPECT_EQ(result, expect_result);
+}
+
+TEST_F(task_queue_test, post_delayed_goes_to_tail) {
+  std::vector<int> result;
+  std::mutex rlock;
+  auto push = [&result, &rlock](int v) {
+    std::lock_guard<std::mutex> _(rlock);
+    result.push_back(v);
+  };
+  tq_->post_task(__TQ_TASK_LOC, [push]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    push(0);
+  });
+  tq_->post_delayed(__TQ_TASK_LOC, [push]() { push(2); }, std::chrono::milliseconds(5));
+  // queued before the delayed task is due, not jumped over
+  tq_->post_task(__TQ_TASK_LOC, [push]() { push(1); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  std::vector<int> expect_result = {0, 1, 2};
+  EXPECT_EQ(result, expect_result);
+}
+
+TEST_F(task_queue_test, post_delayed_to_broken_queue) {
+  tq_->break_queue();
+  auto h = tq_->post_delayed(__TQ_TASK_LOC, []() {}, std::chrono::milliseconds(5));
+  EXPECT_FALSE(h);
+  EXPECT_FALSE(tq_->post_at(__TQ_TASK_LOC, []() {}, libtq::task_now()));
+}
+
+TEST(task_queue_budget_test, yield_after_budget) {
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 1));
+  auto busy = libtq::task_queue::create(eq, wg);
+  auto other = libtq::task_queue::create(eq, wg);
+  busy->set_run_budget(4, std::chrono::seconds(1));
+  std::atomic<int> busy_done(0);
+  std::atomic<int> seen_by_other(-1);
+  libtq::task_batch_t batch;
+  for (int i = 0; i < 100; ++i) {
+    batch.push_back({__TQ_TASK_LOC, [&busy_done]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      ++busy_done;
+    }});
+  }
+  busy->post_tasks(std::move(batch));
+  other->post_task(__TQ_TASK_LOC, [&busy_done, &seen_by_other]() {
+    seen_by_other = busy_done.load();
+  });
+  busy->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(busy_done, 100);
+  // the only worker is given back every 4 tasks
+  EXPECT_GE(seen_by_other, 0);
+  EXPECT_LT(seen_by_other, 50);
+}
+
+TEST(task_queue_mpsc_test, many_producers_stay_serial) {
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 4));
+  auto tq = libtq::task_queue::create(eq, wg);
+  const int producer_count = 4;
+  const int task_count = 2000;
+  std::vector<std::vector<int>> results(producer_count);
+  std::atomic<int> running(0);
+  std::atomic<int> overlapped(0);
+  std::atomic<int> done(0);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < producer_count; ++p) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < task_count; ++i) {
+        tq->post_task(__TQ_TASK_LOC, [&, p, i]() {
+          if (running.fetch_add(1) != 0) ++overlapped;
+          results[p].push_back(i);
+          running.fetch_sub(1);
+          ++done;
+        });
+      }
+    });
+  }
+  for (auto& t : producers) t.join();
+  while (done != producer_count * task_count) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(overlapped, 0);
+  for (int p = 0; p < producer_count; ++p) {
+    ASSERT_EQ(results[p].size(), (size_t)task_count);
+    for (int i = 0; i < task_count; ++i) {
+      EXPECT_EQ(results[p][i], i);
+    }
+  }
+}
+
+TEST(task_queue_ws_test, serial_order_in_work_stealing_mode) {
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 4, libtq::thread_priority::k_normal, libtq::schedule_mode::k_work_stealing));
+  std::vector<libtq::tq_st> queues;
+  for (int q = 0; q < 4; ++q) {
+    queues.push_back(libtq::task_queue::create(eq, wg));
+  }
+  std::vector<std::vector<int>> results(queues.size());
+  std::atomic<int> done(0);
+  const int task_count = 200;
+  // Fan out from inside a worker, every queue must keep its order
+  queues[0]->post_task(__TQ_TASK_LOC, [&]() {
+    for (int i = 0; i < task_count; ++i) {
+      for (size_t q = 0; q < queues.size(); ++q) {
+        queues[q]->post_task(__TQ_TASK_LOC, [&results, &done, q, i]() {
+          results[q].push_back(i);
+          ++done;
+        });
+      }
+    }
+  });
+  while (done != task_count * (int)queues.size()) {
+    std::this_thread::yield();
+  }
+  for (size_t q = 0; q < queues.size(); ++q) {
+    EXPECT_EQ(results[q].size(), (size_t)task_count);
+    for (int i = 0; i < task_count; ++i) {
+      EXPECT_EQ(results[q][i], i);
+    }
+  }
+}
+
+TEST(task_queue_ws_test, owner_blocks_after_fan_out) {
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::wg_st wg(new libtq::worker_group(eq, 2, libtq::thread_priority::k_normal, libtq::schedule_mode::k_work_stealing));
+  auto outer = libtq::task_queue::create(eq, wg);
+  auto inner = libtq::task_queue::create(eq, wg);
+  std::atomic<int> done(0);
+  const int rounds = 500;
+  for (int r = 0; r < rounds; ++r) {
+    outer->post_task(__TQ_TASK_LOC, [&inner, &done]() {
+      // goes to the local deque of this worker
+      inner->post_task(__TQ_TASK_LOC, []() {});
+      // blocks this worker, only the other one can steal and run it
+      inner->sync_task(__TQ_TASK_LOC, []() {});
+      ++done;
+    });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (done != rounds && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(done.load(), rounds);
+}
+
+TEST_F(task_queue_test, recent_trace_snapshot_while_running) {
+  tq_->set_recent_trace_keep_count(16);
+  const int task_count = 10000;
+  std::atomic<bool> done(false);
+  std::thread reader([this, &done]() {
+    while (!done) {
+      auto traces = tq_->recent_trace_info();
+      EXPECT_LE(traces.size(), 16u);
+      // a snapshot never has a torn or out of order item
+      intptr_t last = -1;
+      for (; !traces.empty(); traces.pop()) {
+        if (std::string(traces.front().loc.file) != "trace") continue;
+        EXPECT_GT(traces.front().loc.line, last);
+        EXPECT_LE(traces.front().begin_time, traces.front().end_time);
+        last = traces.front().loc.line;
+      }
+    }
+  });
+  for (int i = 0; i < task_count; ++i) {
+    tq_->post_task(libtq::task_location{"trace", i}, []() {});
+    // the retired rings are freed while the tasks keep writing
+    if (i % 1000 == 500) {
+      tq_->set_recent_trace_keep_count((i / 1000) % 2 == 0 ? 12 : 8);
+    }
+  }
+  tq_->sync_task(libtq::task_location{"trace", task_count}, []() {});
+  done = true;
+  reader.join();
+#if LIBTQ_TRACE_LEVEL >= 1
+  auto traces = tq_->recent_trace_info();
+  ASSERT_EQ(traces.size(), 8u);
+  EXPECT_EQ(traces.back().loc.line, task_count);
+#endif
+}
+
+TEST_F(task_queue_test, trace_levels) {
+#if LIBTQ_TRACE_LEVEL >= 3
+  EXPECT_EQ(tq_->get_trace_level(), libtq::trace_level::k_timestamps);
+  tq_->set_recent_trace_keep_count(8);
+  tq_->set_trace_level(libtq::trace_level::k_off);
+  for (int i = 0; i < 10; ++i) {
+    tq_->post_task(libtq::task_location{"off", i}, []() {});
+  }
+  tq_->sync_task(libtq::task_location{"off", 10}, []() {});
+  EXPECT_TRUE(tq_->recent_trace_info().empty());
+
+  // the location only, no time is taken
+  tq_->set_trace_level(libtq::trace_level::k_location);
+  tq_->sync_task(libtq::task_location{"location", 0}, []() {});
+  auto traces = tq_->recent_trace_info();
+  ASSERT_EQ(traces.size(), 1u);
+  EXPECT_STREQ(traces.back().loc.file, "location");
+  EXPECT_EQ(traces.back().post_time, libtq::task_time_t());
+  EXPECT_EQ(traces.back().begin_time, libtq::task_time_t());
+
+  tq_->set_trace_level(libtq::trace_level::k_histogram);
+  for (int i = 0; i < 100; ++i) {
+    tq_->post_task(libtq::task_location{"histogram", i}, []() {});
+  }
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  traces = tq_->recent_trace_info();
+  EXPECT_NE(traces.back().begin_time, libtq::task_time_t());
+  EXPECT_LE(traces.back().post_time, traces.back().begin_time);
+  auto h = tq_->trace_histogram();
+  uint64_t waits = 0, runs = 0;
+  for (size_t i = 0; i < libtq::task_trace_histogram::k_buckets; ++i) {
+    waits += h.wait[i];
+    runs += h.run[i];
+  }
+  EXPECT_EQ(waits, 101u);
+  EXPECT_EQ(runs, 101u);
+#else
+  // higher levels are compiled out
+  tq_->set_trace_level(libtq::trace_level::k_histogram);
+  EXPECT_EQ((int)tq_->get_trace_level(), LIBTQ_TRACE_LEVEL);
+#endif
+}
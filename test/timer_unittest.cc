@@ -30,10 +30,49 @@ SOFTWARE.
 */
 
 #include "task_timer.h"
+#include "task_clock.h"
 #include "task_queue_manager.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <cmath>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <cstdlib>
+#include <cstring>
+
+// Count the allocations made by the timer thread
+static std::atomic<size_t> g_timer_thread_alloc_count(0);
+
+static bool is_timer_thread() {
+  static thread_local int t_is_timer = -1;
+  if (t_is_timer < 0) {
+    char name[16] = {0};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    t_is_timer = (strncmp(name, "libtq_timer", 11) == 0) ? 1 : 0;
+  }
+  return t_is_timer == 1;
+}
+
+void* operator new(size_t size) {
+  if (is_timer_thread()) {
+    ++g_timer_thread_alloc_count;
+  }
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+#endif
 
 class timer_test : public testing::Test {
 public:
@@ -76,8 +115,6 @@ TEST_F(timer_test, loop_rate) {
 }
 
 TEST_F(timer_test, fire_now) {
-  static double avg_delta = 0.f;
-  static std::list<double> all_delta;
   libtq::timer t(tq_);
   libtq::event_queue<libtq::task_time_t> eq;
   int count = 0;
@@ -107,6 +144,9 @@ TEST_F(timer_test, fire_now) {
   
   delta_list.pop_front();
   
+#if LIBTQ_TRACE_LEVEL >= 2
+  static double avg_delta = 0.f;
+  static std::list<double> all_delta;
   tq_->sync_task(TQ_TASK_LOC, [&]() {
     auto ti_qu = tq_->recent_trace_info();
     auto last = ti_qu.front();
@@ -130,6 +170,7 @@ TEST_F(timer_test, fire_now) {
     }
     printf("delta variance is: %f, data count: %u\n", (variance / (double)all_delta.size()), (unsigned int)all_delta.size());
   });
+#endif
 }
 
 TEST_F(timer_test, fire_once_delay) {
@@ -156,3 +197,382 @@ TEST_F(timer_test, fire_once_cancel) {
   libtq::timer::cancel_once(job_id);
   EXPECT_FALSE(eq.wait_for(std::chrono::milliseconds(20), 2));
 }
+
+TEST_F(timer_test, wheel_engine) {
+  libtq::timer::set_engine(libtq::timer_engine_type::k_wheel, std::chrono::milliseconds(1));
+  std::mutex l;
+  std::vector<int> fired;
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::chrono::steady_clock::duration> lateness(4);
+  // 300ms is beyond the first level, the job is cascaded before firing
+  unsigned int delays[] = { 30, 5, 300, 60 };
+  std::vector<libtq::timer_handle> ids;
+  for (int i = 0; i < 4; ++i) {
+    ids.push_back(libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&, i]() {
+      auto late = std::chrono::steady_clock::now() - begin - std::chrono::milliseconds(delays[i]);
+      std::lock_guard<std::mutex> _(l);
+      lateness[(size_t)i] = late;
+      fired.push_back(i);
+    }, delays[i]));
+  }
+  libtq::timer::cancel_once(ids[3]);
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  libtq::timer::set_engine(libtq::timer_engine_type::k_heap);
+
+  std::lock_guard<std::mutex> _(l);
+  ASSERT_EQ(fired, std::vector<int>({1, 0, 2}));
+  for (int i : fired) {
+    EXPECT_GE(lateness[(size_t)i].count(), 0);
+  }
+}
+
+TEST_F(timer_test, cancel_releases_job) {
+  auto token = std::make_shared<int>(0);
+  auto h = libtq::timer::once_after(tq_, __TQ_TASK_LOC, [token]() {}, 10000);
+  EXPECT_TRUE((bool)h);
+  EXPECT_EQ(token.use_count(), 2);
+  libtq::timer::cancel_once(h);
+  // the job is destroied right away, not when it would have fired
+  EXPECT_EQ(token.use_count(), 1);
+  // cancel again is a no-op
+  libtq::timer::cancel_once(h);
+  EXPECT_FALSE((bool)libtq::timer::once_after(tq_, __TQ_TASK_LOC, []() {}, 0));
+}
+
+TEST_F(timer_test, stale_handle) {
+  libtq::event_queue<int> eq;
+  auto first = libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&eq]() {
+    eq.emplace_back(1);
+  }, 5);
+  ASSERT_TRUE(eq.wait_for(std::chrono::milliseconds(100)));
+  // the slot of the fired job is reused by the next one
+  auto second = libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&eq]() {
+    eq.emplace_back(2);
+  }, 5);
+  EXPECT_NE(first, second);
+  libtq::timer::cancel_once(first);
+  auto r = eq.wait_for(std::chrono::milliseconds(100));
+  ASSERT_TRUE((bool)r);
+  EXPECT_EQ(r->i, 2);
+}
+
+TEST_F(timer_test, concurrent_once_after) {
+  const int thread_count = 4;
+  const int per_thread = 1000;
+  std::vector<std::vector<libtq::timer_handle>> handles((size_t)thread_count);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < per_thread; ++i) {
+        handles[(size_t)t].push_back(libtq::timer::once_after(tq_, __TQ_TASK_LOC, []() {}, 10000));
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  std::set<std::pair<uint32_t, uint32_t>> unique_handles;
+  for (auto& hs : handles) {
+    for (auto& h : hs) {
+      EXPECT_TRUE(unique_handles.emplace(h.slot, h.gen).second);
+      libtq::timer::cancel_once(h);
+    }
+  }
+  EXPECT_EQ(unique_handles.size(), (size_t)(thread_count * per_thread));
+}
+
+TEST_F(timer_test, arm_and_cancel_from_threads) {
+  size_t before = libtq::timer::pending_count();
+  const int thread_count = 4;
+  const int per_thread = 500;
+  std::atomic<int> fired(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < per_thread; ++i) {
+        auto h = libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&fired, i]() {
+          fired += (i % 2 == 0 ? 1 : 100000);
+        }, (i % 2 == 0 ? 5 : 30));
+        if (i % 2 == 1) {
+          libtq::timer::cancel_once(h);
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  std::this_thread::sleep_for(std::chrono::milliseconds(80));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  // only the jobs not cancelled are fired
+  EXPECT_EQ(fired.load(), thread_count * per_thread / 2);
+  EXPECT_EQ(libtq::timer::pending_count(), before);
+
+  // the timer thread sleeps to the far job, an earlier one wakes it up
+  libtq::event_queue<int> eq;
+  auto far = libtq::timer::once_after(tq_, __TQ_TASK_LOC, []() {}, 900);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto begin = std::chrono::steady_clock::now();
+  libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&eq]() { eq.emplace_back(1); }, 5);
+  ASSERT_TRUE((bool)eq.wait_for(std::chrono::milliseconds(200)));
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(100));
+  libtq::timer::cancel_once(far);
+}
+
+TEST_F(timer_test, burst_fire_keeps_order) {
+  auto other = libtq::task_queue_manager::create_task_queue(libtq::thread_priority::k_normal);
+  std::vector<int> seq[2];
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+  for (int i = 0; i < 200; ++i) {
+    auto& q = (i % 2 == 0 ? tq_ : other);
+    auto& s = seq[i % 2];
+    // due close together in arming order, the timer thread fires them in a few passes
+    libtq::timer::once_after(q, __TQ_TASK_LOC, [&s, i]() { s.push_back(i); },
+      deadline - std::chrono::steady_clock::now() + std::chrono::microseconds(i * 100));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  other->sync_task(__TQ_TASK_LOC, []() {});
+  for (int k = 0; k < 2; ++k) {
+    ASSERT_EQ(seq[k].size(), 100u);
+    for (size_t i = 0; i < seq[k].size(); ++i) {
+      EXPECT_EQ(seq[k][i], (int)i * 2 + k);
+    }
+  }
+}
+
+TEST_F(timer_test, stop_removes_periodic_timers) {
+  size_t before = libtq::timer::pending_count();
+  std::atomic<int> fired(0);
+  {
+    std::vector<std::unique_ptr<libtq::timer>> timers;
+    for (int i = 0; i < 1000; ++i) {
+      timers.emplace_back(new libtq::timer(tq_));
+      timers.back()->start(__TQ_TASK_LOC, [&fired]() { ++fired; }, 5);
+    }
+    EXPECT_EQ(libtq::timer::pending_count(), before + 1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (size_t i = 0; i < timers.size(); i += 2) {
+      timers[i]->stop();
+    }
+    EXPECT_EQ(libtq::timer::pending_count(), before + 500);
+    // the others are removed in the destructor
+  }
+  EXPECT_EQ(libtq::timer::pending_count(), before);
+  EXPECT_GT(fired.load(), 0);
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+}
+
+#ifdef __linux__
+TEST_F(timer_test, periodic_fire_does_not_allocate) {
+  std::atomic<int> fired(0);
+  libtq::timer t(tq_);
+  t.start(__TQ_TASK_LOC, [&fired]() { ++fired; }, 1);
+  // warm up the node caches
+  while (fired < 20) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  size_t before = g_timer_thread_alloc_count.load();
+  int fired_before = fired.load();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_GT(fired.load() - fired_before, 50);
+  EXPECT_EQ(g_timer_thread_alloc_count.load(), before);
+  t.stop();
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+}
+#endif
+
+TEST_F(timer_test, switch_backend) {
+  ASSERT_TRUE(libtq::timer::set_backend(libtq::timer_backend::k_condition_variable));
+  libtq::event_queue<int> eq;
+  libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&eq]() { eq.emplace_back(1); }, 5);
+  EXPECT_TRUE((bool)eq.wait_for(std::chrono::milliseconds(100)));
+#ifdef __linux__
+  EXPECT_TRUE(libtq::timer::set_backend(libtq::timer_backend::k_timerfd));
+  libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&eq]() { eq.emplace_back(2); }, 5);
+  EXPECT_TRUE((bool)eq.wait_for(std::chrono::milliseconds(100)));
+#else
+  EXPECT_FALSE(libtq::timer::set_backend(libtq::timer_backend::k_timerfd));
+#endif
+}
+
+TEST_F(timer_test, leeway_coalesce) {
+  std::mutex l;
+  std::vector<std::chrono::steady_clock::time_point> fired;
+  auto begin = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < 10; ++i) {
+    libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&]() {
+      std::lock_guard<std::mutex> _(l);
+      fired.push_back(std::chrono::steady_clock::now());
+    }, 10 + i, std::chrono::milliseconds(20));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> _(l);
+    if (fired.size() == 10u) break;
+  }
+  std::lock_guard<std::mutex> _(l);
+  ASSERT_EQ(fired.size(), 10u);
+  // the windows overlap in [19ms, 30ms], all are fired in one wake up at the end of the first
+  // one; without the leeway they would spread over 9ms, allow 10% of the 30ms for a busy machine
+  auto spread = std::chrono::duration_cast<std::chrono::microseconds>(fired.back() - fired.front()).count();
+  EXPECT_LT(spread, 3000);
+  EXPECT_GE(fired.front() - begin, std::chrono::milliseconds(29));
+}
+
+TEST_F(timer_test, microsecond_interval) {
+  // a virtual clock, each period is fired by its own advance whatever the load is
+  static libtq::manual_clock vclock;
+  libtq::set_task_clock(&vclock);
+  std::atomic<int> fired(0);
+  {
+    libtq::timer t(tq_);
+    t.start(__TQ_TASK_LOC, [&fired]() { ++fired; }, std::chrono::microseconds(250));
+    for (int i = 0; i < 200; ++i) {
+      vclock.advance(std::chrono::microseconds(250));
+    }
+    t.stop();
+    tq_->sync_task(__TQ_TASK_LOC, []() {});
+    EXPECT_EQ(fired.load(), 200);
+  }
+
+  std::atomic<int> once(0);
+  libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&once]() { ++once; }, std::chrono::microseconds(500));
+  vclock.advance(std::chrono::microseconds(400));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(once.load(), 0);
+  vclock.advance(std::chrono::microseconds(100));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(once.load(), 1);
+  libtq::set_task_clock(nullptr);
+}
+
+TEST_F(timer_test, sharded_timers) {
+  libtq::timer::set_shards(4);
+  std::vector<libtq::tq_st> queues;
+  for (int i = 0; i < 16; ++i) {
+    queues.push_back(libtq::task_queue_manager::create_task_queue(libtq::thread_priority::k_normal));
+  }
+  size_t before = libtq::timer::pending_count();
+  std::atomic<int> fired(0);
+  std::set<uint32_t> shards;
+  std::vector<libtq::timer_handle> cancelled;
+  for (size_t i = 0; i < queues.size(); ++i) {
+    auto h = libtq::timer::once_after(queues[i], __TQ_TASK_LOC, [&fired]() { ++fired; }, 5);
+    shards.insert(h.shard);
+    cancelled.push_back(libtq::timer::once_after(queues[i], __TQ_TASK_LOC, [&fired]() { fired += 100; }, 5));
+  }
+  EXPECT_GT(shards.size(), 1u);
+  for (auto& h : cancelled) {
+    libtq::timer::cancel_once(h);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (auto& q : queues) {
+    q->sync_task(__TQ_TASK_LOC, []() {});
+  }
+  EXPECT_EQ(fired.load(), 16);
+  EXPECT_EQ(libtq::timer::pending_count(), before);
+  libtq::timer::set_shards(1);
+}
+
+TEST_F(timer_test, debouncer_runs_after_quiet_window) {
+  std::atomic<int> runs(0);
+  libtq::debouncer d(tq_, __TQ_TASK_LOC, [&runs]() { ++runs; }, std::chrono::milliseconds(10));
+  auto begin = std::chrono::steady_clock::now();
+  // 20ms of triggers every 1ms, collapsed into one run 10ms after the last one
+  while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(20)) {
+    d.trigger();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(runs.load(), 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(runs.load(), 1);
+
+  // a cancelled run is dropped, the next trigger starts over
+  d.trigger();
+  d.cancel();
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(runs.load(), 1);
+  d.trigger();
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(runs.load(), 2);
+}
+
+TEST_F(timer_test, throttler_runs_once_per_window) {
+  // a virtual clock, the count of windows does not depend on the load
+  static libtq::manual_clock vclock;
+  libtq::set_task_clock(&vclock);
+  std::atomic<int> runs(0);
+  {
+    libtq::throttler t(tq_, __TQ_TASK_LOC, [&runs]() { ++runs; }, std::chrono::milliseconds(10));
+    t.trigger();
+    tq_->sync_task(__TQ_TASK_LOC, []() {});
+    // the first trigger runs right away
+    EXPECT_EQ(runs.load(), 1);
+    // 50ms of triggers every 200us, one run at the end of each of the 5 windows
+    for (int i = 0; i < 250; ++i) {
+      t.trigger();
+      vclock.advance(std::chrono::microseconds(200));
+      tq_->sync_task(__TQ_TASK_LOC, []() {});
+    }
+    EXPECT_EQ(runs.load(), 6);
+    // the window opened by the last run ends with nothing to run
+    vclock.advance(std::chrono::milliseconds(30));
+    tq_->sync_task(__TQ_TASK_LOC, []() {});
+    EXPECT_EQ(runs.load(), 6);
+  }
+  libtq::set_task_clock(nullptr);
+}
+
+TEST_F(timer_test, debouncer_and_throttler_remove_their_timer_job) {
+  size_t before = libtq::timer::pending_count();
+  std::atomic<int> runs(0);
+  {
+    libtq::debouncer d(tq_, __TQ_TASK_LOC, [&runs]() { ++runs; }, std::chrono::hours(1));
+    libtq::throttler t(tq_, __TQ_TASK_LOC, [&runs]() { ++runs; }, std::chrono::hours(1));
+    d.trigger();
+    d.trigger();
+    EXPECT_EQ(libtq::timer::pending_count(), before + 1);
+    d.cancel();
+    EXPECT_EQ(libtq::timer::pending_count(), before);
+    d.trigger();
+    EXPECT_EQ(libtq::timer::pending_count(), before + 1);
+    // the window stays open after a cancel
+    t.trigger();
+    t.trigger();
+    t.cancel();
+    EXPECT_EQ(libtq::timer::pending_count(), before + 2);
+  }
+  EXPECT_EQ(libtq::timer::pending_count(), before);
+  tq_->sync_task(__TQ_TASK_LOC, []() {});
+  EXPECT_EQ(runs.load(), 1);
+}
+
+TEST_F(timer_test, manual_clock_runs_hours_instantly) {
+  // must outlive the timer threads
+  static libtq::manual_clock vclock;
+  libtq::set_task_clock(&vclock);
+  std::atomic<int> ticks(0);
+  std::atomic<int> once(0);
+  auto begin = std::chrono::steady_clock::now();
+  {
+    libtq::timer t(tq_);
+    t.start(__TQ_TASK_LOC, [&ticks]() { ++ticks; }, std::chrono::seconds(1));
+    libtq::timer::once_after(tq_, __TQ_TASK_LOC, [&once]() { ++once; }, std::chrono::hours(1));
+    for (int i = 0; i < 1800; ++i) {
+      vclock.advance(std::chrono::seconds(1));
+    }
+    tq_->sync_task(__TQ_TASK_LOC, []() {});
+    EXPECT_EQ(ticks.load(), 1800);
+    EXPECT_EQ(once.load(), 0);
+    for (int i = 0; i < 1800; ++i) {
+      vclock.advance(std::chrono::seconds(1));
+    }
+    tq_->sync_task(__TQ_TASK_LOC, []() {});
+    EXPECT_EQ(ticks.load(), 3600);
+    EXPECT_EQ(once.load(), 1);
+    t.stop();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(10));
+  // go back to steady_clock, the armed timers keep the virtual fire time
+  libtq::set_task_clock(nullptr);
+}
@@ -123,3 +123,30 @@ TEST_F(worker_group_test, in_worker_group) {
     std::this_thread::yield();
   }
 }
+
+TEST(worker_group_ws_test, fan_out_from_worker) {
+  libtq::eq_st eq(new libtq::eq_t);
+  libtq::worker_group wg(eq, 4, libtq::thread_priority::k_normal, libtq::schedule_mode::k_work_stealing);
+  EXPECT_EQ(wg.mode(), libtq::schedule_mode::k_work_stealing);
+  const int sub_count = 1000;
+  std::atomic<int> count(0);
+  std::atomic<int> in_group(0);
+  libtq::task root;
+  root.t = [&eq, &wg, &count, &in_group, sub_count]() {
+    for (int i = 0; i < sub_count; ++i) {
+      libtq::task sub;
+      sub.t = [&wg, &count, &in_group]() {
+        if (wg.in_worker_group()) ++in_group;
+        ++count;
+      };
+      // goes to the local deque of current worker
+      libtq::worker::dispatch(*eq, std::move(sub), 2);
+    }
+  };
+  eq->emplace_back(std::move(root));
+  while (count != sub_count) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(in_group, sub_count);
+  EXPECT_EQ(eq->pending_count(), 0);
+}